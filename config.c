@@ -0,0 +1,71 @@
+#include "gpad.h"
+
+GpadConfig gpad_config = {
+    .tree_sitter_max_bytes = 16 * 1024 * 1024,
+    .sourceview_max_bytes  = 4 * 1024 * 1024,
+    .search_simd           = TRUE,
+};
+
+
+/**
+ * Reads a non-negative size from the key file into *value, leaving it unchanged
+ * when the key is missing or invalid.
+ */
+static void read_size(GKeyFile *key_file, const char *group, const char *key, gsize *value) {
+    if (!g_key_file_has_key(key_file, group, key, NULL)) return;
+
+    GError *error = NULL;
+    gint64 size = g_key_file_get_int64(key_file, group, key, &error);
+    if (error) {
+        g_warning("Ignoring %s.%s in config: %s", group, key, error->message);
+        g_error_free(error);
+        return;
+    }
+    if (size < 0) {
+        g_warning("Ignoring negative %s.%s in config", group, key);
+        return;
+    }
+    *value = (gsize)size;
+}
+
+
+/**
+ * Reads a boolean from the key file into *value, leaving it unchanged when the
+ * key is missing or invalid.
+ */
+static void read_bool(GKeyFile *key_file, const char *group, const char *key, gboolean *value) {
+    if (!g_key_file_has_key(key_file, group, key, NULL)) return;
+
+    GError *error = NULL;
+    gboolean flag = g_key_file_get_boolean(key_file, group, key, &error);
+    if (error) {
+        g_warning("Ignoring %s.%s in config: %s", group, key, error->message);
+        g_error_free(error);
+        return;
+    }
+    *value = flag;
+}
+
+
+/**
+ * Loads settings from gpad.conf in the user's config directory
+ * (~/.config/gpad/gpad.conf), keeping the defaults for anything not set.
+ */
+void load_config(void) {
+    char *path = g_build_filename(g_get_user_config_dir(), "gpad", "gpad.conf", NULL);
+    GKeyFile *key_file = g_key_file_new();
+    GError *error = NULL;
+
+    if (g_key_file_load_from_file(key_file, path, G_KEY_FILE_NONE, &error)) {
+        read_size(key_file, "highlighting", "tree_sitter_max_bytes", &gpad_config.tree_sitter_max_bytes);
+        read_size(key_file, "highlighting", "sourceview_max_bytes",  &gpad_config.sourceview_max_bytes);
+        read_bool(key_file, "search", "simd", &gpad_config.search_simd);
+    } else {
+        if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            g_warning("Failed to read %s: %s", path, error->message);
+        g_error_free(error);
+    }
+
+    g_key_file_free(key_file);
+    g_free(path);
+}
@@ -44,12 +44,13 @@ static void save_tab_content(TabInfo *tab_info) {
     if (f) {
         GtkTextIter start, end;
         gtk_text_buffer_get_bounds(tab_info->buffer, &start, &end);
-        char *text = gtk_text_buffer_get_text(tab_info->buffer, &start, &end, FALSE);
+        char *text = gtk_text_buffer_get_text(tab_info->buffer, &start, &end, TRUE);
         fputs(text, f);
         fclose(f);
         g_free(text);
 
         tab_info->dirty = FALSE;
+        gtk_text_buffer_set_modified(tab_info->buffer, FALSE);
         update_tab_label(tab_info);
         add_to_recent_files(tab_info->filename);
         g_print("Saved file: %s\n", tab_info->filename);
@@ -0,0 +1,194 @@
+#include "gpad.h"
+#include <gtksourceview/gtksource.h>
+
+#ifdef HAVE_TREE_SITTER
+
+#define FOLD_MARK_OPEN   "\xe2\x96\xbe"
+#define FOLD_MARK_CLOSED "\xe2\x96\xb8"
+
+
+/**
+ * Returns the index of the first fold starting at or after a byte offset.
+ * Folds are sorted by start byte, outer folds first.
+ */
+guint fold_index_at(GArray *folds, guint32 byte) {
+    guint lo = 0, hi = folds->len;
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        if (g_array_index(folds, FoldRange, mid).start < byte) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+
+/**
+ * Returns the outermost fold starting on a line, or NULL if none does.
+ */
+static FoldRange* fold_at_line(TabInfo *tab, int line) {
+    if (!tab->folds || !tab->line_index) return NULL;
+
+    GtkTextIter iter;
+    gtk_text_buffer_get_iter_at_line(tab->buffer, &iter, line);
+    guint32 line_start = line_index_byte_at_iter(tab->line_index, &iter);
+    guint32 line_end = line_start + (guint32)gtk_text_iter_get_bytes_in_line(&iter);
+
+    guint lo = fold_index_at(tab->folds, line_start);
+    if (lo < tab->folds->len && g_array_index(tab->folds, FoldRange, lo).start < line_end)
+        return &g_array_index(tab->folds, FoldRange, lo);
+    return NULL;
+}
+
+
+/**
+ * Sets iterators to the text a fold hides: from the end of its first line to
+ * the end of the folded node.
+ */
+static void fold_hidden_range(TabInfo *tab, const FoldRange *fold, GtkTextIter *start, GtkTextIter *end) {
+    line_index_iter_at_byte(tab->line_index, start, fold->start);
+    if (!gtk_text_iter_ends_line(start)) gtk_text_iter_forward_to_line_end(start);
+    line_index_iter_at_byte(tab->line_index, end, fold->end);
+}
+
+
+/**
+ * Hides or shows the text of a fold with the shared invisible "fold" tag.
+ * Showing a fold keeps the folds nested inside it that are still folded hidden.
+ */
+void fold_apply(TabInfo *tab, const FoldRange *fold, gboolean folded) {
+    GtkTextTag *tag = gtk_text_tag_table_lookup(gtk_text_buffer_get_tag_table(tab->buffer), "fold");
+    if (!tag) return;
+
+    GtkTextIter start, end;
+    fold_hidden_range(tab, fold, &start, &end);
+    if (gtk_text_iter_compare(&start, &end) >= 0) return;
+
+    if (folded) {
+        gtk_text_buffer_apply_tag(tab->buffer, tag, &start, &end);
+        return;
+    }
+
+    gtk_text_buffer_remove_tag(tab->buffer, tag, &start, &end);
+    if (!tab->folds) return;
+    for (guint i = fold_index_at(tab->folds, fold->start); i < tab->folds->len; i++) {
+        const FoldRange *inner = &g_array_index(tab->folds, FoldRange, i);
+        if (inner->start >= fold->end) break;
+        if (inner != fold && inner->folded && inner->end <= fold->end) {
+            GtkTextIter inner_start, inner_end;
+            fold_hidden_range(tab, inner, &inner_start, &inner_end);
+            if (gtk_text_iter_compare(&inner_start, &inner_end) < 0)
+                gtk_text_buffer_apply_tag(tab->buffer, tag, &inner_start, &inner_end);
+        }
+    }
+}
+
+
+/**
+ * Asks the fold gutter to redraw after the tab's folds changed.
+ */
+void fold_refresh(TabInfo *tab) {
+    if (tab && tab->fold_renderer) gtk_widget_queue_draw(tab->fold_renderer);
+}
+
+
+/**
+ * Gutter callback: shows an open or closed marker on lines that start a fold.
+ */
+static void on_fold_query_data(GtkSourceGutterRenderer *renderer, GtkSourceGutterLines *lines, guint line, gpointer user_data) {
+    (void)lines;
+    TabInfo *tab = (TabInfo*)user_data;
+    FoldRange *fold = fold_at_line(tab, (int)line);
+    const char *mark = fold ? (fold->folded ? FOLD_MARK_CLOSED : FOLD_MARK_OPEN) : "";
+    gtk_source_gutter_renderer_text_set_text(GTK_SOURCE_GUTTER_RENDERER_TEXT(renderer), mark, -1);
+}
+
+
+/**
+ * Gutter callback: only lines that start a fold can be clicked.
+ */
+static gboolean on_fold_query_activatable(GtkSourceGutterRenderer *renderer, GtkTextIter *iter, GdkRectangle *area, gpointer user_data) {
+    (void)renderer; (void)area;
+    return fold_at_line((TabInfo*)user_data, gtk_text_iter_get_line(iter)) != NULL;
+}
+
+
+/**
+ * Gutter callback: toggles the fold starting on the clicked line.
+ */
+static void on_fold_activate(GtkSourceGutterRenderer *renderer, GtkTextIter *iter, GdkRectangle *area,
+                             guint button, GdkModifierType state, gint n_presses, gpointer user_data) {
+    (void)renderer; (void)area; (void)button; (void)state; (void)n_presses;
+    TabInfo *tab = (TabInfo*)user_data;
+    FoldRange *fold = fold_at_line(tab, gtk_text_iter_get_line(iter));
+    if (!fold) return;
+
+    fold->folded = !fold->folded;
+    fold_apply(tab, fold, fold->folded);
+    fold_refresh(tab);
+}
+
+
+/**
+ * Adds the fold gutter to a tab highlighted by tree-sitter. The fold ranges
+ * themselves are maintained by the highlighter from each parse.
+ */
+void fold_attach(TabInfo *tab) {
+    if (!tab || tab->fold_renderer || tab->highlight_engine != HIGHLIGHT_ENGINE_TREE_SITTER) return;
+
+    tab->folds = g_array_new(FALSE, FALSE, sizeof(FoldRange));
+
+    GtkSourceGutterRenderer *renderer = gtk_source_gutter_renderer_text_new();
+    gtk_source_gutter_renderer_set_xpad(renderer, 2);
+    g_signal_connect(renderer, "query-data", G_CALLBACK(on_fold_query_data), tab);
+    g_signal_connect(renderer, "query-activatable", G_CALLBACK(on_fold_query_activatable), tab);
+    g_signal_connect(renderer, "activate", G_CALLBACK(on_fold_activate), tab);
+
+    GtkSourceGutter *gutter = gtk_source_view_get_gutter(GTK_SOURCE_VIEW(tab->text_view), GTK_TEXT_WINDOW_LEFT);
+    gtk_source_gutter_insert(gutter, renderer, 10);
+    tab->fold_renderer = GTK_WIDGET(renderer);
+}
+
+
+/**
+ * Removes the fold gutter from a tab and frees its fold ranges.
+ */
+void fold_detach(TabInfo *tab) {
+    if (!tab) return;
+
+    if (tab->fold_renderer) {
+        g_signal_handlers_disconnect_by_data(tab->fold_renderer, tab);
+        GtkSourceGutter *gutter = gtk_source_view_get_gutter(GTK_SOURCE_VIEW(tab->text_view), GTK_TEXT_WINDOW_LEFT);
+        gtk_source_gutter_remove(gutter, GTK_SOURCE_GUTTER_RENDERER(tab->fold_renderer));
+        tab->fold_renderer = NULL;
+    }
+    if (tab->folds) {
+        g_array_free(tab->folds, TRUE);
+        tab->folds = NULL;
+    }
+}
+
+#else
+
+
+guint fold_index_at(GArray *folds, guint32 byte) {
+    (void)folds; (void)byte;
+    return 0;
+}
+
+void fold_apply(TabInfo *tab, const FoldRange *fold, gboolean folded) {
+    (void)tab; (void)fold; (void)folded;
+}
+
+void fold_refresh(TabInfo *tab) {
+    (void)tab;
+}
+
+void fold_attach(TabInfo *tab) {
+    (void)tab;
+}
+
+void fold_detach(TabInfo *tab) {
+    (void)tab;
+}
+
+#endif
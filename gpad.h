@@ -28,6 +28,31 @@ typedef enum {
 } LanguageType;
 
  
+typedef enum {
+    HIGHLIGHT_ENGINE_NONE,
+    HIGHLIGHT_ENGINE_SOURCEVIEW,
+    HIGHLIGHT_ENGINE_TREE_SITTER
+} HighlightEngine;
+
+ 
+typedef struct {
+    gsize tree_sitter_max_bytes;
+    gsize sourceview_max_bytes;
+    gboolean search_simd;
+} GpadConfig;
+
+ 
+typedef struct {
+    guint32  start;
+    guint32  end;
+    gboolean folded;
+} FoldRange;
+
+ 
+typedef struct _LineIndex LineIndex;
+typedef struct _ParseJob  ParseJob;
+
+ 
 typedef struct {
     GtkWidget     *scrolled_window;        
     GtkWidget     *text_view;              
@@ -35,9 +60,29 @@ typedef struct {
     char          *filename;               
     gboolean       dirty;                  
     LanguageType   lang_type;              
+    HighlightEngine highlight_engine;
+    LineIndex     *line_index;
 
      
     TSTreePtr      ts_tree;
+    gboolean       ts_edit_pending;
+    guint32        ts_edit_start;
+    guint32        ts_edit_end;
+    GArray        *ts_tagged;
+    guint          revision;
+    GCancellable  *parse_cancellable;
+    ParseJob      *parse_job;
+    gboolean       parse_queued;
+    guint          tag_idle_id;
+    guint32        tag_pending_start;
+    guint32        tag_pending_end;
+    gint64         parse_cost_us;
+    GArray        *folds;
+    GtkWidget     *fold_renderer;
+    GtkWidget     *scope_header;
+    guint          scope_tick_id;
+    gulong         scope_scroll_handler;
+    guint32        scope_top_byte;
 
      
     gboolean       auto_scroll_enabled;
@@ -48,6 +93,10 @@ typedef struct {
     gulong         buffer_changed_handler;
     gulong         cursor_mark_handler;
     gulong         modified_close_handler;
+    gulong         insert_text_handler;
+    gulong         delete_range_handler;
+    gulong         viewport_handler;
+    gulong         viewport_resize_handler;
     guint          highlight_source_id;
 } TabInfo;
 
@@ -76,14 +125,7 @@ extern GtkListBox       *recent_list_box;
 extern char             *current_directory;
 extern GtkRecentManager *recent_manager;
 extern gboolean          app_initialized;
-
-#ifdef HAVE_TREE_SITTER
-extern TSParser *ts_parser;
- 
-const TSLanguage *tree_sitter_c(void);
-const TSLanguage *tree_sitter_python(void);
-const TSLanguage *tree_sitter_dart(void);
-#endif
+extern GpadConfig        gpad_config;
 
  
 /** Initializes the main application. */
@@ -110,8 +152,12 @@ TabInfo* get_current_tab_info(void);
 gboolean close_current_tab(void);
 /** Updates the tab's visual label. */
 void     update_tab_label(TabInfo *tab_info);
-/** Sets up highlighting tags for a buffer. */
-void     setup_highlighting_tags(GtkTextBuffer *buffer);
+/** Returns the highlight/search tag table shared by all buffers. */
+GtkTextTagTable* get_shared_tag_table(void);
+/** Recolours the shared highlight tags for the light or dark theme. */
+void     set_highlight_tag_theme(gboolean dark);
+/** Releases the shared tag table. */
+void     cleanup_shared_tag_table(void);
 /** Signal handler for tab switch. */
 void     on_tab_switched(GtkNotebook *notebook, GtkWidget *page, guint page_num, gpointer user_data);
 /** Enables/disables auto-scroll. */
@@ -128,16 +174,62 @@ void         add_to_recent_files(const char *filename);
 LanguageType get_language_from_filename(const char *filename);
 
  
-/** Synchronously highlights a buffer. */
-void     highlight_buffer_sync(GtkTextBuffer *buffer, TSTreePtr *ts_tree, LanguageType lang);
+/** Creates a byte offset index that follows edits to a buffer. */
+LineIndex* line_index_new(GtkTextBuffer *buffer);
+/** Frees a line index. */
+void       line_index_free(LineIndex *index);
+/** Sets an iterator to a byte offset using the index. */
+void       line_index_iter_at_byte(LineIndex *index, GtkTextIter *iter, guint32 byte);
+/** Returns the byte offset of an iterator using the index. */
+guint32    line_index_byte_at_iter(LineIndex *index, const GtkTextIter *iter);
+
+ 
+/** Parses a tab on a worker thread and applies its highlighting when done. */
+void     highlight_buffer_async(TabInfo *tab);
 /** Timeout callback for highlighting. */
 gboolean highlight_timeout_callback(gpointer user_data);
+/** Returns the debounce delay before reparsing a tab, adapted to its parse cost. */
+guint    highlight_delay_ms(TabInfo *tab);
+/** Connects a tab's edit and scroll signals to the highlighter. */
+void     highlight_attach(TabInfo *tab);
+/** Disconnects a tab from the highlighter. */
+void     highlight_detach(TabInfo *tab);
+/** Writes a tab's highlight spans to the span cache and waits for it. */
+void     highlight_save_spans(TabInfo *tab);
+/** Paints cached highlight spans onto a freshly loaded tab. */
+void     highlight_restore_spans(TabInfo *tab, const char *contents, gsize length);
+/** Marks the bracket pair at the cursor from the syntax tree. */
+void     highlight_match_brackets(TabInfo *tab);
+/** Returns the declarations enclosing a byte offset, outermost first, or NULL. */
+gchar*   highlight_scope_chain(TabInfo *tab, guint32 byte);
+/** Adds the sticky scope header to a tree-sitter tab. */
+void     scope_header_attach(TabInfo *tab);
+/** Removes the sticky scope header from a tab. */
+void     scope_header_detach(TabInfo *tab);
+/** Recomputes the scope header after a parse. */
+void     scope_header_refresh(TabInfo *tab);
+/** Adds the fold gutter to a tree-sitter tab. */
+void     fold_attach(TabInfo *tab);
+/** Removes the fold gutter and frees a tab's folds. */
+void     fold_detach(TabInfo *tab);
+/** Hides or shows the text of a fold. */
+void     fold_apply(TabInfo *tab, const FoldRange *fold, gboolean folded);
+/** Redraws the fold gutter. */
+void     fold_refresh(TabInfo *tab);
+/** Returns the index of the first fold starting at or after a byte offset. */
+guint    fold_index_at(GArray *folds, guint32 byte);
+/** Returns whether tree-sitter can highlight a language. */
+gboolean highlight_supports_language(LanguageType lang);
 /** Initializes tree-sitter. */
 void     init_tree_sitter(void);
 /** Cleans up tree-sitter. */
 void     cleanup_tree_sitter(void);
 
  
+/** Loads user settings from the config file. */
+void       load_config(void);
+
+ 
 /** Creates the file tree view widget. */
 GtkWidget* create_file_tree_view(void);
 /** Refreshes file tree for generic directory. */
@@ -0,0 +1,160 @@
+#include "gpad.h"
+
+struct _LineIndex {
+    GtkTextBuffer *buffer;
+    GArray        *line_starts;
+    guint32        deleted_bytes;
+    gulong         insert_handler;
+    gulong         delete_before_handler;
+    gulong         delete_after_handler;
+};
+
+
+/**
+ * Recomputes the byte offset of every line start from the buffer.
+ */
+static void line_index_rebuild(LineIndex *index) {
+    int lines = gtk_text_buffer_get_line_count(index->buffer);
+    g_array_set_size(index->line_starts, lines);
+
+    GtkTextIter iter;
+    gtk_text_buffer_get_start_iter(index->buffer, &iter);
+    guint32 offset = 0;
+    for (int i = 0; i < lines; i++) {
+        g_array_index(index->line_starts, guint32, i) = offset;
+        offset += gtk_text_iter_get_bytes_in_line(&iter);
+        gtk_text_iter_forward_line(&iter);
+    }
+}
+
+
+/**
+ * Recomputes the starts of lines (first, last] by walking forward from line first.
+ */
+static void line_index_refresh_lines(LineIndex *index, int first, int last) {
+    GtkTextIter iter;
+    gtk_text_buffer_get_iter_at_line(index->buffer, &iter, first);
+    for (int i = first + 1; i <= last; i++) {
+        g_array_index(index->line_starts, guint32, i) =
+            g_array_index(index->line_starts, guint32, i - 1) + gtk_text_iter_get_bytes_in_line(&iter);
+        gtk_text_iter_forward_line(&iter);
+    }
+}
+
+
+/**
+ * Resizes the index by the change in line count, inserting or dropping entries after line.
+ */
+static void line_index_resize_after(LineIndex *index, int line) {
+    int old_count = (int)index->line_starts->len;
+    int new_count = gtk_text_buffer_get_line_count(index->buffer);
+
+    if (new_count > old_count) {
+        guint32 *fill = g_new0(guint32, new_count - old_count);
+        g_array_insert_vals(index->line_starts, line + 1, fill, new_count - old_count);
+        g_free(fill);
+    } else if (new_count < old_count) {
+        g_array_remove_range(index->line_starts, line + 1, old_count - new_count);
+    }
+}
+
+
+/**
+ * Updates the index after text was inserted; location points past the new text.
+ */
+static void on_insert_text_after(GtkTextBuffer *buffer, GtkTextIter *location, char *text, int len, gpointer user_data) {
+    (void)buffer;
+    LineIndex *index = (LineIndex*)user_data;
+
+    GtkTextIter start = *location;
+    gtk_text_iter_backward_chars(&start, (int)g_utf8_strlen(text, len));
+    int first = gtk_text_iter_get_line(&start);
+    int last  = gtk_text_iter_get_line(location);
+
+    line_index_resize_after(index, first);
+    for (guint i = last + 1; i < index->line_starts->len; i++)
+        g_array_index(index->line_starts, guint32, i) += (guint32)len;
+    line_index_refresh_lines(index, first, last);
+}
+
+
+/**
+ * Records how many bytes a deletion removes while the index still matches the buffer.
+ */
+static void on_delete_range_before(GtkTextBuffer *buffer, GtkTextIter *start, GtkTextIter *end, gpointer user_data) {
+    (void)buffer;
+    LineIndex *index = (LineIndex*)user_data;
+    index->deleted_bytes = line_index_byte_at_iter(index, end) - line_index_byte_at_iter(index, start);
+}
+
+
+/**
+ * Updates the index after a deletion; start and end both point at the deletion site.
+ */
+static void on_delete_range_after(GtkTextBuffer *buffer, GtkTextIter *start, GtkTextIter *end, gpointer user_data) {
+    (void)buffer; (void)end;
+    LineIndex *index = (LineIndex*)user_data;
+    int line = gtk_text_iter_get_line(start);
+
+    line_index_resize_after(index, line);
+    for (guint i = line + 1; i < index->line_starts->len; i++)
+        g_array_index(index->line_starts, guint32, i) -= index->deleted_bytes;
+    if ((guint)line + 1 < index->line_starts->len)
+        line_index_refresh_lines(index, line, line + 1);
+    index->deleted_bytes = 0;
+}
+
+
+/**
+ * Builds a line-start byte index for a buffer and keeps it current across edits,
+ * so byte offsets (tree-sitter nodes, search matches) convert to iterators with
+ * a binary search instead of a scan from the start of the text.
+ */
+LineIndex* line_index_new(GtkTextBuffer *buffer) {
+    LineIndex *index = g_new0(LineIndex, 1);
+    index->buffer = buffer;
+    index->line_starts = g_array_new(FALSE, FALSE, sizeof(guint32));
+    line_index_rebuild(index);
+
+    index->insert_handler        = g_signal_connect_after(buffer, "insert-text", G_CALLBACK(on_insert_text_after), index);
+    index->delete_before_handler = g_signal_connect(buffer, "delete-range", G_CALLBACK(on_delete_range_before), index);
+    index->delete_after_handler  = g_signal_connect_after(buffer, "delete-range", G_CALLBACK(on_delete_range_after), index);
+    return index;
+}
+
+
+/**
+ * Disconnects the index from its buffer and frees it.
+ */
+void line_index_free(LineIndex *index) {
+    if (!index) return;
+    g_signal_handler_disconnect(index->buffer, index->insert_handler);
+    g_signal_handler_disconnect(index->buffer, index->delete_before_handler);
+    g_signal_handler_disconnect(index->buffer, index->delete_after_handler);
+    g_array_free(index->line_starts, TRUE);
+    g_free(index);
+}
+
+
+/**
+ * Sets an iterator to a byte offset of the buffer.
+ */
+void line_index_iter_at_byte(LineIndex *index, GtkTextIter *iter, guint32 byte) {
+    guint lo = 0, hi = index->line_starts->len;
+    while (hi - lo > 1) {
+        guint mid = lo + (hi - lo) / 2;
+        if (g_array_index(index->line_starts, guint32, mid) <= byte) lo = mid;
+        else hi = mid;
+    }
+    guint32 line_start = g_array_index(index->line_starts, guint32, lo);
+    gtk_text_buffer_get_iter_at_line_index(index->buffer, iter, (int)lo, (int)(byte - line_start));
+}
+
+
+/**
+ * Returns the byte offset of an iterator from the start of the buffer.
+ */
+guint32 line_index_byte_at_iter(LineIndex *index, const GtkTextIter *iter) {
+    int line = gtk_text_iter_get_line(iter);
+    return g_array_index(index->line_starts, guint32, line) + (guint32)gtk_text_iter_get_line_index(iter);
+}
@@ -16,14 +16,11 @@ GtkWidget *footer_label = NULL;
 static GtkCssProvider *current_css_provider = NULL;
 static gboolean is_dark_mode = FALSE;
 
-#ifdef HAVE_TREE_SITTER
-TSParser *ts_parser = NULL;
-#endif
-
 
 static void on_page_removed(GtkNotebook *notebook, GtkWidget *child, guint page_num, gpointer user_data);
 static gboolean update_after_tab_close(gpointer user_data);
 static gboolean on_key_pressed(GtkEventControllerKey *controller, guint keyval, guint keycode, GdkModifierType state, gpointer user_data);
+static gboolean on_window_close_request(GtkWindow *window, gpointer user_data);
 
 
 
@@ -197,6 +194,24 @@ static void load_theme(const char *theme_path) {
 }
 
 
+/**
+ * Saves the highlight span cache of every open tab before the window closes,
+ * since tabs still open at exit are never detached. Returns FALSE so the
+ * window closes normally.
+ */
+static gboolean on_window_close_request(GtkWindow *window, gpointer user_data) {
+    (void)window; (void)user_data;
+    if (!global_notebook) return FALSE;
+
+    for (int i = 0; i < gtk_notebook_get_n_pages(global_notebook); i++) {
+        GtkWidget *page = gtk_notebook_get_nth_page(global_notebook, i);
+        TabInfo *info = page ? (TabInfo*)g_object_get_data(G_OBJECT(page), "tab_info") : NULL;
+        if (info) highlight_save_spans(info);
+    }
+    return FALSE;
+}
+
+
 /**
  * Callback for the theme toggle button to switch between light and dark modes.
  */
@@ -206,10 +221,12 @@ static void on_theme_toggle_clicked(GtkButton *button, gpointer user_data) {
 
     if (is_dark_mode) {
         load_theme("cyberpunk-theme.css");
+        set_highlight_tag_theme(TRUE);
 
         gtk_button_set_icon_name(button, "weather-clear-symbolic");
     } else {
         load_theme("old-macos-theme.css");
+        set_highlight_tag_theme(FALSE);
 
         gtk_button_set_icon_name(button, "weather-clear-night-symbolic");
     }
@@ -229,6 +246,7 @@ void initialize_application(GtkApplication *app) {
     global_window = window;
     gtk_window_set_title(GTK_WINDOW(window), "GPad - Multi-Tab Editor");
     gtk_window_set_default_size(GTK_WINDOW(window), 1200, 800);
+    g_signal_connect(window, "close-request", G_CALLBACK(on_window_close_request), NULL);
 
 
     GtkEventController *key_controller = gtk_event_controller_key_new();
@@ -295,6 +313,7 @@ void initialize_application(GtkApplication *app) {
 
     gtk_widget_set_visible(panel_container, FALSE);
 
+    load_config();
 #ifdef HAVE_TREE_SITTER
     init_tree_sitter();
 #endif
@@ -397,6 +416,7 @@ void cleanup_resources(void) {
 #endif
     g_free(current_directory);
     current_directory = NULL;
+    cleanup_shared_tag_table();
 }
 
 
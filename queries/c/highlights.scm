@@ -0,0 +1,73 @@
+; Highlight captures for C. Capture names are the editor's tag names
+; (comment, string, preproc, keyword, control, type, number, function,
+; constant, decorator); a dotted suffix such as @function.macro falls back
+; to the part before the dot.
+
+(comment) @comment
+
+(string_literal) @string
+(system_lib_string) @string
+(char_literal) @string
+
+(number_literal) @number
+
+[
+  "#define"
+  "#elif"
+  "#else"
+  "#endif"
+  "#if"
+  "#ifdef"
+  "#ifndef"
+  "#include"
+  (preproc_directive)
+] @preproc
+
+[
+  "break"
+  "case"
+  "continue"
+  "default"
+  "do"
+  "else"
+  "for"
+  "goto"
+  "if"
+  "return"
+  "switch"
+  "while"
+] @control
+
+[
+  "const"
+  "enum"
+  "extern"
+  "inline"
+  "sizeof"
+  "static"
+  "struct"
+  "typedef"
+  "union"
+  "volatile"
+] @keyword
+
+(primitive_type) @type
+(sized_type_specifier) @type
+(type_identifier) @type
+
+(function_declarator
+  declarator: (identifier) @function)
+(call_expression
+  function: (identifier) @function)
+(call_expression
+  function: (field_expression
+    field: (field_identifier) @function))
+(preproc_function_def
+  name: (identifier) @function.macro)
+
+(preproc_def
+  name: (identifier) @constant)
+(enumerator
+  name: (identifier) @constant)
+(true) @constant
+(false) @constant
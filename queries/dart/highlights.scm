@@ -0,0 +1,51 @@
+; Highlight captures for Dart. See queries/c/highlights.scm for the
+; capture names the editor understands.
+
+(comment) @comment
+(documentation_comment) @comment
+
+(string_literal) @string
+
+(decimal_integer_literal) @number
+(decimal_floating_point_literal) @number
+(hex_integer_literal) @number
+
+(import_or_export) @preproc
+
+[
+  "break"
+  "case"
+  "catch"
+  "continue"
+  "default"
+  "do"
+  "else"
+  "finally"
+  "for"
+  "if"
+  "return"
+  "switch"
+  "try"
+  "while"
+] @control
+
+[
+  "class"
+  "enum"
+  "extends"
+  "new"
+] @keyword
+(const_builtin) @keyword
+(final_builtin) @keyword
+
+(type_identifier) @type
+(void_type) @type
+
+(function_signature
+  name: (identifier) @function)
+
+(true) @constant
+(false) @constant
+(null_literal) @constant
+
+(annotation) @decorator
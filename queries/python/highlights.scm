@@ -0,0 +1,68 @@
+; Highlight captures for Python. See queries/c/highlights.scm for the
+; capture names the editor understands.
+
+(comment) @comment
+
+(string) @string
+
+(integer) @number
+(float) @number
+
+[
+  "from"
+  "import"
+] @preproc
+
+[
+  "break"
+  "continue"
+  "elif"
+  "else"
+  "except"
+  "finally"
+  "for"
+  "if"
+  "raise"
+  "return"
+  "try"
+  "while"
+  "with"
+  "yield"
+] @control
+
+[
+  "and"
+  "as"
+  "assert"
+  "async"
+  "await"
+  "class"
+  "def"
+  "del"
+  "global"
+  "in"
+  "is"
+  "lambda"
+  "nonlocal"
+  "not"
+  "or"
+  "pass"
+] @keyword
+
+(type) @type
+(class_definition
+  name: (identifier) @type)
+
+(function_definition
+  name: (identifier) @function)
+(call
+  function: (identifier) @function)
+(call
+  function: (attribute
+    attribute: (identifier) @function))
+
+(true) @constant
+(false) @constant
+(none) @constant
+
+(decorator) @decorator
@@ -0,0 +1,139 @@
+#include "gpad.h"
+
+#ifdef HAVE_TREE_SITTER
+
+#define SCOPE_NONE G_MAXUINT32
+
+
+/**
+ * Returns the byte offset of the first line shown in the tab's text view.
+ */
+static guint32 top_visible_byte(TabInfo *tab) {
+    GdkRectangle visible;
+    GtkTextIter iter;
+    gtk_text_view_get_visible_rect(GTK_TEXT_VIEW(tab->text_view), &visible);
+    gtk_text_view_get_line_at_y(GTK_TEXT_VIEW(tab->text_view), &iter, visible.y, NULL);
+    return line_index_byte_at_iter(tab->line_index, &iter);
+}
+
+
+/**
+ * Shows the declarations enclosing the top visible line, or hides the header
+ * when there are none. Nothing is looked up while the top line stays the same.
+ */
+static void scope_header_update(TabInfo *tab) {
+    if (!tab->ts_tree || !tab->line_index) {
+        gtk_widget_set_visible(tab->scope_header, FALSE);
+        return;
+    }
+
+    guint32 top = top_visible_byte(tab);
+    if (top == tab->scope_top_byte) return;
+    tab->scope_top_byte = top;
+
+    gchar *chain = highlight_scope_chain(tab, top);
+    gtk_label_set_text(GTK_LABEL(tab->scope_header), chain ? chain : "");
+    gtk_widget_set_visible(tab->scope_header, chain != NULL);
+    g_free(chain);
+}
+
+
+/**
+ * Frame clock callback: updates the header once for all the scroll events
+ * since the last frame.
+ */
+static gboolean on_scope_tick(GtkWidget *widget, GdkFrameClock *clock, gpointer user_data) {
+    (void)widget; (void)clock;
+    TabInfo *tab = (TabInfo*)user_data;
+    tab->scope_tick_id = 0;
+    scope_header_update(tab);
+    return G_SOURCE_REMOVE;
+}
+
+
+/**
+ * Queues a header update for the next frame unless one is already queued.
+ */
+static void scope_header_queue(TabInfo *tab) {
+    if (!tab->scope_header || tab->scope_tick_id) return;
+    tab->scope_tick_id = gtk_widget_add_tick_callback(tab->text_view, on_scope_tick, tab, NULL);
+}
+
+
+/**
+ * Scroll handler: the top visible line may have changed.
+ */
+static void on_scope_scroll(GtkAdjustment *adjustment, gpointer user_data) {
+    (void)adjustment;
+    scope_header_queue((TabInfo*)user_data);
+}
+
+
+/**
+ * Recomputes the header after the tab's syntax tree changed.
+ */
+void scope_header_refresh(TabInfo *tab) {
+    if (!tab || !tab->scope_header) return;
+    tab->scope_top_byte = SCOPE_NONE;
+    scope_header_queue(tab);
+}
+
+
+/**
+ * Adds the sticky scope header above the text of a tab highlighted by tree-sitter.
+ */
+void scope_header_attach(TabInfo *tab) {
+    if (!tab || tab->scope_header || tab->highlight_engine != HIGHLIGHT_ENGINE_TREE_SITTER) return;
+
+    GtkWidget *label = gtk_label_new(NULL);
+    gtk_label_set_xalign(GTK_LABEL(label), 0.0);
+    gtk_label_set_ellipsize(GTK_LABEL(label), PANGO_ELLIPSIZE_START);
+    gtk_widget_set_margin_start(label, 6);
+    gtk_widget_set_margin_end(label, 6);
+    gtk_widget_add_css_class(label, "dim-label");
+    gtk_widget_set_visible(label, FALSE);
+    gtk_text_view_set_gutter(GTK_TEXT_VIEW(tab->text_view), GTK_TEXT_WINDOW_TOP, label);
+
+    tab->scope_header = label;
+    tab->scope_top_byte = SCOPE_NONE;
+
+    GtkAdjustment *vadj = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(tab->scrolled_window));
+    tab->scope_scroll_handler = g_signal_connect(vadj, "value-changed", G_CALLBACK(on_scope_scroll), tab);
+}
+
+
+/**
+ * Removes the scope header from a tab and stops its updates.
+ */
+void scope_header_detach(TabInfo *tab) {
+    if (!tab || !tab->scope_header) return;
+
+    if (tab->scope_tick_id) {
+        gtk_widget_remove_tick_callback(tab->text_view, tab->scope_tick_id);
+        tab->scope_tick_id = 0;
+    }
+    if (tab->scope_scroll_handler) {
+        GtkAdjustment *vadj = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(tab->scrolled_window));
+        g_signal_handler_disconnect(vadj, tab->scope_scroll_handler);
+        tab->scope_scroll_handler = 0;
+    }
+    gtk_text_view_set_gutter(GTK_TEXT_VIEW(tab->text_view), GTK_TEXT_WINDOW_TOP, NULL);
+    tab->scope_header = NULL;
+}
+
+#else
+
+
+void scope_header_refresh(TabInfo *tab) {
+    (void)tab;
+}
+
+void scope_header_attach(TabInfo *tab) {
+    (void)tab;
+}
+
+void scope_header_detach(TabInfo *tab) {
+    (void)tab;
+}
+
+#endif
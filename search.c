@@ -1,67 +1,113 @@
 #include "gpad.h"
 #include "search.h"
+#include "search_kernels.h"
 #include <string.h>
 #include <ctype.h>
 
+#define SEARCH_CHUNK_BYTES (4 * 1024 * 1024)
+
 static GtkWidget *search_revealer = NULL;
 static GtkWidget *search_entry = NULL;
 static GtkWidget *search_prev_btn = NULL;
 static GtkWidget *search_next_btn = NULL;
 static GtkWidget *search_label = NULL;
+static GCancellable *search_cancellable = NULL;
 
  
 
-#define ALPHABET_SIZE 256
-
 /**
- * Computes the bad character table for the Boyer-Moore string search algorithm.
+ * Appends every byte offset of a pattern of m bytes in the first n bytes of text,
+ * with the vector kernels unless search.simd is turned off in the config.
  */
-static void compute_bad_char_table(const char *pattern, int m, int bad_char[ALPHABET_SIZE]) {
-    for (int i = 0; i < ALPHABET_SIZE; i++)
-        bad_char[i] = -1;
-
-    for (int i = 0; i < m; i++)
-        bad_char[(unsigned char)pattern[i]] = i;
+static void exact_match(const char *text, int n, const char *pattern, int m, GArray *results) {
+    SearchKernelKind kind = gpad_config.search_simd ? SEARCH_KERNEL_AUTO : SEARCH_KERNEL_SCALAR;
+    search_find_all(kind, text, n, pattern, m, results);
 }
 
  
+typedef struct {
+    GtkTextBuffer *buffer;
+    guint          revision;
+    char          *pattern;
+    char          *text;
+    int            length;
+    GArray        *results;
+} SearchJob;
+
+
 /**
- * Implements the Boyer-Moore algorithm for exact string matching.
- * Returns an array of byte offsets where the pattern was found.
+ * Frees a search job and drops its reference on the buffer.
  */
-static GArray* exact_match_boyer_moore(const char *text, const char *pattern) {
-    GArray *results = g_array_new(FALSE, FALSE, sizeof(int));
-    if (!text || !pattern || !*pattern) return results;
+static void search_job_free(gpointer data) {
+    SearchJob *job = (SearchJob*)data;
+    g_object_unref(job->buffer);
+    g_free(job->pattern);
+    g_free(job->text);
+    if (job->results) g_array_free(job->results, TRUE);
+    g_free(job);
+}
 
-    int n = strlen(text);
-    int m = strlen(pattern);
-    if (m > n) return results;
+ 
+typedef struct {
+    TabInfo *tab;
+    guint    revision;
+    char    *pattern;
+    GArray  *results;
+} SearchResults;
 
-    int bad_char[ALPHABET_SIZE];
-    compute_bad_char_table(pattern, m, bad_char);
+static SearchResults *last_search = NULL;
 
-    int s = 0;  
-    while (s <= (n - m)) {
-        int j = m - 1;
 
-         
-        while (j >= 0 && pattern[j] == text[s + j])
-            j--;
+/**
+ * Drops the remembered results of the last search; also called when its tab
+ * is switched away from or closed.
+ */
+void forget_search_results(void) {
+    if (!last_search) return;
+    g_free(last_search->pattern);
+    g_array_free(last_search->results, TRUE);
+    g_free(last_search);
+    last_search = NULL;
+}
 
-        if (j < 0) {
-             
-            g_array_append_val(results, s);
 
-             
-            s += (s + m < n) ? m - bad_char[(unsigned char)text[s + m]] : 1;
-        } else {
-             
-            int bc_shift = j - bad_char[(unsigned char)text[s + j]];
-            s += (1 > bc_shift) ? 1 : bc_shift;
-        }
+/**
+ * Remembers the match offsets of a finished search on a tab, taking them over
+ * from the job, so that a longer query on the same buffer revision can be
+ * answered from them. The job's text snapshot is not kept.
+ */
+static void remember_search(TabInfo *tab, SearchJob *job) {
+    forget_search_results();
+    last_search = g_new0(SearchResults, 1);
+    last_search->tab      = tab;
+    last_search->revision = job->revision;
+    last_search->pattern  = g_strdup(job->pattern);
+    last_search->results  = job->results;
+    job->results = NULL;
+}
+
+
+/**
+ * Worker thread body: scans the snapshot in chunks, checking between chunks
+ * whether a newer query has cancelled the job. Chunks overlap by the pattern
+ * length less one byte so no match is split or found twice.
+ */
+static void search_job_run(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable) {
+    (void)source_object;
+    SearchJob *job = (SearchJob*)task_data;
+    int m = strlen(job->pattern);
+
+    for (int offset = 0; offset + m <= job->length; offset += SEARCH_CHUNK_BYTES) {
+        if (g_cancellable_is_cancelled(cancellable)) break;
+
+        int window = MIN(SEARCH_CHUNK_BYTES + m - 1, job->length - offset);
+        guint first = job->results->len;
+        exact_match(job->text + offset, window, job->pattern, m, job->results);
+        for (guint i = first; i < job->results->len; i++)
+            g_array_index(job->results, int, i) += offset;
     }
 
-    return results;
+    g_task_return_boolean(task, TRUE);
 }
 
  
@@ -81,112 +127,174 @@ static void clear_search_highlights(GtkTextBuffer *buffer) {
 }
 
 /**
- * Highlights find results in the buffer based on provided offsets.
+ * Highlights find results in the buffer from ascending byte offsets into content,
+ * a slice of the whole buffer. One iterator walks forward from match to match,
+ * counting only the characters in between, so k matches in n bytes cost O(n + k)
+ * instead of a conversion from the start of the text for every match.
+ * Sets first to the start of the first match.
  */
-static void highlight_results(GtkTextBuffer *buffer, GArray *offsets, int pattern_len) {
-    if (!buffer || !offsets) return;
+static void highlight_results(GtkTextBuffer *buffer, const char *content, GArray *offsets, const char *pattern, GtkTextIter *first) {
+    if (!buffer || !content || !offsets || offsets->len == 0) return;
 
-     
     GtkTextTagTable *table = gtk_text_buffer_get_tag_table(buffer);
     GtkTextTag *tag = gtk_text_tag_table_lookup(table, "search-result");
-    if (!tag) {
-        tag = gtk_text_buffer_create_tag(buffer, "search-result",
-                                       "background", "#FFFF00",
-                                       "foreground", "#000000",
-                                       NULL);
-    }
+    if (!tag) return;
+
+    int pattern_chars = (int)g_utf8_strlen(pattern, -1);
+
+    GtkTextIter match_start;
+    gtk_text_buffer_get_start_iter(buffer, &match_start);
+    int position = 0;
 
-     
-     
-     
-    
-     
-    
-    GtkTextIter iter;
-    gtk_text_buffer_get_start_iter(buffer, &iter);
-    
     for (guint i = 0; i < offsets->len; i++) {
         int byte_offset = g_array_index(offsets, int, i);
-        
-        GtkTextIter start_iter = iter;
-         
-         
-         
-         
-         
-        
-         
-         
-         
-        
-         
-        gtk_text_buffer_get_iter_at_offset(buffer, &start_iter, 0);  
-        
-         
-         
-         
-        
-         
-         
-         
-         
-         
-        
-         
-         
-        
-         
-         
-         
-        
-         
-         
-         
-        
-         
-        
+        gtk_text_iter_forward_chars(&match_start, (int)g_utf8_strlen(content + position, byte_offset - position));
+        position = byte_offset;
+
+        GtkTextIter match_end = match_start;
+        gtk_text_iter_forward_chars(&match_end, pattern_chars);
+        gtk_text_buffer_apply_tag(buffer, tag, &match_start, &match_end);
+
+        if (i == 0 && first) *first = match_start;
     }
-    
-     
-     
-     
-    
-     
+}
+
+/**
+ * Cancels the search in flight, if any; its results will be discarded.
+ */
+static void cancel_search(void) {
+    if (!search_cancellable) return;
+    g_cancellable_cancel(search_cancellable);
+    g_clear_object(&search_cancellable);
+}
+
+/**
+ * Shows the number of matches in the search bar.
+ */
+static void show_match_count(guint count) {
+    if (!search_label) return;
+    if (count > 0) {
+        char *status = g_strdup_printf("%u found", count);
+        gtk_label_set_text(GTK_LABEL(search_label), status);
+        g_free(status);
+    } else {
+        gtk_label_set_text(GTK_LABEL(search_label), "No results");
+    }
+}
+
+/**
+ * Replaces the search highlights in a tab with the matches of a finished scan,
+ * scrolls to the first one and shows the count.
+ */
+static void show_search_results(TabInfo *tab, const SearchJob *job) {
+    clear_search_highlights(tab->buffer);
+    GArray *results = job->results;
+
+    if (results->len > 0) {
+        GtkTextIter first;
+        gtk_text_buffer_get_start_iter(tab->buffer, &first);
+        highlight_results(tab->buffer, job->text, results, job->pattern, &first);
+        gtk_text_view_scroll_to_iter(GTK_TEXT_VIEW(tab->text_view), &first, 0.0, FALSE, 0, 0);
+    }
+    show_match_count(results->len);
+}
+
+/**
+ * Main-thread completion of a search job: highlights the matches if the job is
+ * still the latest query for the current tab and keeps them for refinement.
+ * A search made stale by edits to the buffer is rerun.
+ */
+static void on_search_job_done(GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    (void)source_object; (void)user_data;
+    GTask *task = G_TASK(result);
+    GError *error = NULL;
+    g_task_propagate_boolean(task, &error);
+    if (error) {
+        g_error_free(error);
+        return;
+    }
+
+    g_clear_object(&search_cancellable);
+    SearchJob *job = (SearchJob*)g_task_get_task_data(task);
+
+    TabInfo *tab = get_current_tab_info();
+    if (!tab || tab->buffer != job->buffer) return;
+    if (tab->revision != job->revision) {
+        perform_search(job->pattern);
+        return;
+    }
+
+    show_search_results(tab, job);
+    remember_search(tab, job);
+}
+
+/**
+ * Answers a query that extends the last search's query on the same buffer
+ * revision by checking only the offsets that matched before, since every match
+ * of the longer query starts with a match of the shorter one. Each offset is
+ * checked against the buffer through the tab's line index; dropped matches lose
+ * their highlight and kept ones are extended, so an extra keystroke costs
+ * O(k log n) for k previous matches instead of a rescan of the document.
+ * Returns FALSE if the query cannot be refined this way.
+ */
+static gboolean refine_search(TabInfo *tab, const char *text) {
+    if (!last_search) return FALSE;
+    if (last_search->tab != tab || last_search->revision != tab->revision || !tab->line_index) {
+        forget_search_results();
+        return FALSE;
+    }
+    if (!g_str_has_prefix(text, last_search->pattern)) return FALSE;
+
+    GtkTextTag *tag = gtk_text_tag_table_lookup(gtk_text_buffer_get_tag_table(tab->buffer), "search-result");
+    if (!tag) return FALSE;
+
+    int old_chars = (int)g_utf8_strlen(last_search->pattern, -1);
+    int new_chars = (int)g_utf8_strlen(text, -1);
+    GArray *results = last_search->results;
+    guint kept = 0;
+
+    for (guint i = 0; i < results->len; i++) {
+        int offset = g_array_index(results, int, i);
+        GtkTextIter start, end;
+        line_index_iter_at_byte(tab->line_index, &start, offset);
+        end = start;
+        gtk_text_iter_forward_chars(&end, new_chars);
+
+        char *candidate = gtk_text_buffer_get_slice(tab->buffer, &start, &end, TRUE);
+        gboolean matches = strcmp(candidate, text) == 0;
+        g_free(candidate);
+
+        if (matches) {
+            g_array_index(results, int, kept++) = offset;
+        } else {
+            end = start;
+            gtk_text_iter_forward_chars(&end, old_chars);
+            gtk_text_buffer_remove_tag(tab->buffer, tag, &start, &end);
+        }
+    }
+    g_array_set_size(results, kept);
+
      
-    
-    char *text = NULL;
-    GtkTextIter start_bounds, end_bounds;
-    gtk_text_buffer_get_bounds(buffer, &start_bounds, &end_bounds);
-    text = gtk_text_buffer_get_text(buffer, &start_bounds, &end_bounds, FALSE);
-    
-    if (!text) return;
-    
-    for (guint i = 0; i < offsets->len; i++) {
-        int byte_offset = g_array_index(offsets, int, i);
-        long char_offset = g_utf8_pointer_to_offset(text, text + byte_offset);
-        
-        GtkTextIter match_start, match_end;
-        gtk_text_buffer_get_iter_at_offset(buffer, &match_start, (gint)char_offset);
-        match_end = match_start;
-        
-         
-         long pattern_char_len = g_utf8_strlen(text + byte_offset, pattern_len); 
-          
-          
-         
-        gtk_text_iter_forward_chars(&match_end, (gint)pattern_char_len);  
-        
-          
-          
-         
-         gtk_text_buffer_apply_tag(buffer, tag, &match_start, &match_end);
+    for (guint i = 0; i < results->len; i++) {
+        GtkTextIter start, end;
+        line_index_iter_at_byte(tab->line_index, &start, g_array_index(results, int, i));
+        end = start;
+        gtk_text_iter_forward_chars(&end, new_chars);
+        gtk_text_buffer_apply_tag(tab->buffer, tag, &start, &end);
+        if (i == 0) gtk_text_view_scroll_to_iter(GTK_TEXT_VIEW(tab->text_view), &start, 0.0, FALSE, 0, 0);
     }
-    
-    g_free(text);
+
+    g_free(last_search->pattern);
+    last_search->pattern = g_strdup(text);
+    show_match_count(results->len);
+    return TRUE;
 }
 
 /**
- * Main search function that finds and highlights matches in the current tab.
+ * Main search function: refines the last search when the term extends it, and
+ * otherwise snapshots the current tab's text and scans it for the search term
+ * on a worker thread, cancelling any search still running for an earlier query.
+ * Matches are highlighted when the scan completes.
  */
 void perform_search(const char *text) {
     if (!text || !*text) return;
@@ -194,58 +302,27 @@ void perform_search(const char *text) {
     TabInfo *tab = get_current_tab_info();
     if (!tab || !tab->buffer) return;
 
-    clear_search_highlights(tab->buffer);
+    cancel_search();
+    if (refine_search(tab, text)) return;
 
     GtkTextIter start, end;
     gtk_text_buffer_get_bounds(tab->buffer, &start, &end);
-    char *content = gtk_text_buffer_get_text(tab->buffer, &start, &end, FALSE);
-
+    char *content = gtk_text_buffer_get_slice(tab->buffer, &start, &end, TRUE);
     if (!content) return;
 
-    GArray *results = exact_match_boyer_moore(content, text);
-    
-    if (results->len > 0) {
-         
-        int pattern_len = strlen(text);  
-        long pattern_char_len = g_utf8_strlen(text, -1);
-        
-         
-        GtkTextTagTable *table = gtk_text_buffer_get_tag_table(tab->buffer);
-        GtkTextTag *tag = gtk_text_tag_table_lookup(table, "search-result");
-        if (!tag) {
-            tag = gtk_text_buffer_create_tag(tab->buffer, "search-result",
-                                           "background", "#FFFF00",
-                                           "foreground", "#000000",
-                                           NULL);
-        }
-        
-        for (guint i = 0; i < results->len; i++) {
-            int byte_offset = g_array_index(results, int, i);
-            long char_offset = g_utf8_pointer_to_offset(content, content + byte_offset);
-            
-            GtkTextIter m_start, m_end;
-            gtk_text_buffer_get_iter_at_offset(tab->buffer, &m_start, (gint)char_offset);
-            m_end = m_start;
-            gtk_text_iter_forward_chars(&m_end, (gint)pattern_char_len);
-            
-            gtk_text_buffer_apply_tag(tab->buffer, tag, &m_start, &m_end);
-            
-             
-            if (i == 0) {
-                 gtk_text_view_scroll_to_iter(GTK_TEXT_VIEW(tab->text_view), &m_start, 0.0, FALSE, 0, 0);
-            }
-        }
-        
-        char *status = g_strdup_printf("%u found", results->len);
-        if (search_label) gtk_label_set_text(GTK_LABEL(search_label), status);
-        g_free(status);
-
-    } else {
-        if (search_label) gtk_label_set_text(GTK_LABEL(search_label), "No results");
-    }
-
-    g_array_free(results, TRUE);
-    g_free(content);
+    SearchJob *job = g_new0(SearchJob, 1);
+    job->buffer   = g_object_ref(tab->buffer);
+    job->revision = tab->revision;
+    job->pattern  = g_strdup(text);
+    job->text     = content;
+    job->length   = strlen(content);
+    job->results  = g_array_new(FALSE, FALSE, sizeof(int));
+
+    search_cancellable = g_cancellable_new();
+    GTask *task = g_task_new(NULL, search_cancellable, on_search_job_done, NULL);
+    g_task_set_task_data(task, job, search_job_free);
+    g_task_run_in_thread(task, search_job_run);
+    g_object_unref(task);
 }
 
 /**
@@ -257,6 +334,8 @@ static void on_search_changed(GtkSearchEntry *entry, gpointer user_data) {
     if (text && strlen(text) > 0) {
         perform_search(text);
     } else {
+         cancel_search();
+         forget_search_results();
          TabInfo *tab = get_current_tab_info();
          if (tab) clear_search_highlights(tab->buffer);
          if (search_label) gtk_label_set_text(GTK_LABEL(search_label), "");
@@ -374,6 +453,8 @@ void toggle_search_bar(void) {
     
     if (revealed) {
         gtk_revealer_set_reveal_child(GTK_REVEALER(search_revealer), FALSE);
+        cancel_search();
+        forget_search_results();
         TabInfo *tab = get_current_tab_info();
         if (tab) {
              clear_search_highlights(tab->buffer);
@@ -388,7 +469,7 @@ void toggle_search_bar(void) {
         if (tab && tab->buffer) {
              GtkTextIter start, end;
              if (gtk_text_buffer_get_selection_bounds(tab->buffer, &start, &end)) {
-                 char *sel = gtk_text_buffer_get_text(tab->buffer, &start, &end, FALSE);
+                 char *sel = gtk_text_buffer_get_text(tab->buffer, &start, &end, TRUE);
                  gtk_editable_set_text(GTK_EDITABLE(search_entry), sel);
                  g_free(sel);
              }
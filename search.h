@@ -9,5 +9,7 @@ GtkWidget* init_search_ui(void);
 void toggle_search_bar(void);
 /** Performs matching and highlighting for search term. */
 void perform_search(const char *text);
+/** Drops the results kept for refining the last search. */
+void forget_search_results(void);
 
 #endif
@@ -0,0 +1,265 @@
+#include "search_kernels.h"
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_SEARCH_SIMD 1
+#endif
+
+#ifdef SEARCH_COUNT_COMPARED
+guint64 search_bytes_compared = 0;
+#define COUNT_COMPARED(bytes) (search_bytes_compared += (guint64)(bytes))
+#else
+#define COUNT_COMPARED(bytes) ((void)(bytes))
+#endif
+
+
+/**
+ * Computes the maximal suffix of the pattern under the byte order, or under the
+ * reversed order when reversed is set. Returns the index before the suffix
+ * starts and stores the suffix's period in *period.
+ */
+static int maximal_suffix(const char *pattern, int m, int *period, gboolean reversed) {
+    int ms = -1, j = 0, k = 1;
+    *period = 1;
+
+    while (j + k < m) {
+        unsigned char a = (unsigned char)pattern[j + k];
+        unsigned char b = (unsigned char)pattern[ms + k];
+        if (reversed ? a > b : a < b) {
+            j += k;
+            k = 1;
+            *period = j - ms;
+        } else if (a == b) {
+            if (k != *period) {
+                k++;
+            } else {
+                j += *period;
+                k = 1;
+            }
+        } else {
+            ms = j;
+            j = ms + 1;
+            k = *period = 1;
+        }
+    }
+    return ms;
+}
+
+
+/**
+ * Implements the Two-Way (Crochemore-Perrin) algorithm for exact string matching,
+ * appending every byte offset from start on where the pattern occurs. The pattern
+ * is split at a critical factorization; the right half is matched left to right
+ * and the left half right to left, and each shift keeps what the last attempt
+ * proved, so the search reads at most 2n bytes of text whatever the input, with
+ * no tables beyond two integers.
+ */
+static void two_way_search(const char *text, int n, int start, const char *pattern, int m, GArray *results) {
+    int p, q;
+    int i = maximal_suffix(pattern, m, &p, FALSE);
+    int j = maximal_suffix(pattern, m, &q, TRUE);
+    int ell = (i > j) ? i : j;
+    int period = (i > j) ? p : q;
+
+    if (memcmp(pattern, pattern + period, ell + 1) == 0) {
+         
+        int memory = -1;
+        int s = start;
+        while (s <= n - m) {
+            int k = ((ell > memory) ? ell : memory) + 1;
+            int from = k;
+            while (k < m && pattern[k] == text[s + k])
+                k++;
+            COUNT_COMPARED(k - from + (k < m));
+
+            if (k >= m) {
+                k = ell;
+                while (k > memory && pattern[k] == text[s + k])
+                    k--;
+                COUNT_COMPARED(ell - k + (k > memory));
+                if (k <= memory)
+                    g_array_append_val(results, s);
+                s += period;
+                memory = m - period - 1;
+            } else {
+                s += k - ell;
+                memory = -1;
+            }
+        }
+    } else {
+         
+        period = ((ell + 1 > m - ell - 1) ? ell + 1 : m - ell - 1) + 1;
+        int s = start;
+        while (s <= n - m) {
+            int k = ell + 1;
+            while (k < m && pattern[k] == text[s + k])
+                k++;
+            COUNT_COMPARED(k - ell - 1 + (k < m));
+
+            if (k >= m) {
+                k = ell;
+                while (k >= 0 && pattern[k] == text[s + k])
+                    k--;
+                COUNT_COMPARED(ell - k + (k >= 0));
+                if (k < 0)
+                    g_array_append_val(results, s);
+                s += period;
+            } else {
+                s += k - ell;
+            }
+        }
+    }
+}
+
+ 
+#ifdef HAVE_SEARCH_SIMD
+
+ 
+#define SEARCH_VERIFY_SLACK 4096
+
+typedef int (*VectorKernel)(const char *text, int n, const char *pattern, int m, GArray *results);
+
+
+/**
+ * Verifies the candidate positions in a block mask (bit i set means the first
+ * and last pattern bytes match at base + i) and records the real matches.
+ * Returns how many candidates were compared, matches included: a text dense
+ * with matches costs a full comparison per position just like false candidates.
+ */
+static inline int verify_candidates(const char *text, int base, unsigned int mask,
+                                    const char *pattern, int m, GArray *results) {
+    int compared = 0;
+    while (mask) {
+        int s = base + __builtin_ctz(mask);
+        if (m <= 2 || memcmp(text + s + 1, pattern + 1, m - 2) == 0)
+            g_array_append_val(results, s);
+        COUNT_COMPARED(m > 2 ? m - 2 : 0);
+        compared++;
+        mask &= mask - 1;
+    }
+    return compared;
+}
+
+
+/**
+ * Checks the positions from s on that are too close to the end of the text
+ * for a full vector load.
+ */
+static void screen_tail(const char *text, int n, int s, const char *pattern, int m, GArray *results) {
+    for (; s <= n - m; s++) {
+        COUNT_COMPARED(m);
+        if (text[s] == pattern[0] && text[s + m - 1] == pattern[m - 1] &&
+            (m <= 2 || memcmp(text + s + 1, pattern + 1, m - 2) == 0))
+            g_array_append_val(results, s);
+    }
+}
+
+
+/**
+ * SSE2 kernel: compares 16 positions at a time against the first and last
+ * pattern bytes and runs a full comparison only where both match.
+ * Returns the offset it stopped at: past the last position when done, or
+ * earlier when candidate comparisons cost more than the text scanned so far.
+ */
+static int exact_match_sse2(const char *text, int n, const char *pattern, int m, GArray *results) {
+    const __m128i first = _mm_set1_epi8(pattern[0]);
+    const __m128i last  = _mm_set1_epi8(pattern[m - 1]);
+
+    gint64 verified = 0;
+    int s = 0;
+    for (; s + m - 1 + 16 <= n; s += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i*)(text + s));
+        __m128i block_last  = _mm_loadu_si128((const __m128i*)(text + s + m - 1));
+        COUNT_COMPARED(2 * 16);
+        __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last));
+        verified += (gint64)m * verify_candidates(text, s, (unsigned int)_mm_movemask_epi8(eq), pattern, m, results);
+        if (verified > s + SEARCH_VERIFY_SLACK) return s + 16;
+    }
+    screen_tail(text, n, s, pattern, m, results);
+    return n - m + 1;
+}
+
+
+/**
+ * AVX2 kernel: the SSE2 screen over 32 positions at a time.
+ */
+__attribute__((target("avx2")))
+static int exact_match_avx2(const char *text, int n, const char *pattern, int m, GArray *results) {
+    const __m256i first = _mm256_set1_epi8(pattern[0]);
+    const __m256i last  = _mm256_set1_epi8(pattern[m - 1]);
+
+    gint64 verified = 0;
+    int s = 0;
+    for (; s + m - 1 + 32 <= n; s += 32) {
+        __m256i block_first = _mm256_loadu_si256((const __m256i*)(text + s));
+        __m256i block_last  = _mm256_loadu_si256((const __m256i*)(text + s + m - 1));
+        COUNT_COMPARED(2 * 32);
+        __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last));
+        verified += (gint64)m * verify_candidates(text, s, (unsigned int)_mm256_movemask_epi8(eq), pattern, m, results);
+        if (verified > s + SEARCH_VERIFY_SLACK) return s + 32;
+    }
+    screen_tail(text, n, s, pattern, m, results);
+    return n - m + 1;
+}
+
+
+/**
+ * Picks the widest vector kernel the CPU supports, once.
+ */
+static VectorKernel vector_kernel(void) {
+    static VectorKernel kernel = NULL;
+    if (!kernel) {
+        __builtin_cpu_init();
+        kernel = __builtin_cpu_supports("avx2") ? exact_match_avx2 : exact_match_sse2;
+    }
+    return kernel;
+}
+
+#endif
+
+
+/**
+ * Returns whether a search kernel can run on this CPU.
+ */
+gboolean search_kernel_available(SearchKernelKind kind) {
+    switch (kind) {
+    case SEARCH_KERNEL_AUTO:
+    case SEARCH_KERNEL_SCALAR:
+        return TRUE;
+#ifdef HAVE_SEARCH_SIMD
+    case SEARCH_KERNEL_SSE2:
+        return TRUE;
+    case SEARCH_KERNEL_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return FALSE;
+    }
+}
+
+
+/**
+ * Appends every byte offset of a pattern of m bytes in the first n bytes of text.
+ * The vector kernels screen candidates by the pattern's first and last bytes and
+ * hand the rest of the text to the Two-Way search once verifying candidates,
+ * false or dense true ones, costs more than the text they have scanned. SEARCH_KERNEL_AUTO picks the widest kernel the CPU supports,
+ * or the Two-Way search alone where there is none; SEARCH_KERNEL_SCALAR is the
+ * Two-Way search alone, the reference the vector kernels are tested against.
+ * A kernel the CPU does not support finds nothing.
+ */
+void search_find_all(SearchKernelKind kind, const char *text, int n, const char *pattern, int m, GArray *results) {
+    if (m <= 0 || m > n || !search_kernel_available(kind)) return;
+
+    int start = 0;
+#ifdef HAVE_SEARCH_SIMD
+    switch (kind) {
+    case SEARCH_KERNEL_AUTO: start = vector_kernel()(text, n, pattern, m, results); break;
+    case SEARCH_KERNEL_SSE2: start = exact_match_sse2(text, n, pattern, m, results); break;
+    case SEARCH_KERNEL_AVX2: start = exact_match_avx2(text, n, pattern, m, results); break;
+    default: break;
+    }
+#endif
+    if (start <= n - m) two_way_search(text, n, start, pattern, m, results);
+}
@@ -0,0 +1,23 @@
+#ifndef SEARCH_KERNELS_H
+#define SEARCH_KERNELS_H
+
+#include <glib.h>
+
+typedef enum {
+    SEARCH_KERNEL_AUTO,
+    SEARCH_KERNEL_SCALAR,
+    SEARCH_KERNEL_SSE2,
+    SEARCH_KERNEL_AVX2
+} SearchKernelKind;
+
+/** Returns whether a search kernel can run on this CPU. */
+gboolean search_kernel_available(SearchKernelKind kind);
+/** Appends every byte offset of a pattern in text using the given kernel. */
+void search_find_all(SearchKernelKind kind, const char *text, int n, const char *pattern, int m, GArray *results);
+
+#ifdef SEARCH_COUNT_COMPARED
+/** Text bytes the kernels have compared so far; only in builds for the tests. */
+extern guint64 search_bytes_compared;
+#endif
+
+#endif
@@ -1,107 +1,1718 @@
 #include "gpad.h"
+#include <glib/gstdio.h>
 
 #ifdef HAVE_TREE_SITTER
+#include <gmodule.h>
+
+#define HIGHLIGHT_VIEWPORT_MIN_LINES    2000
+#define HIGHLIGHT_VIEWPORT_MARGIN_LINES 60
+#define HIGHLIGHT_PARSE_SLICE_US        20000
+#define HIGHLIGHT_PARSE_LIMIT_US        (5 * G_USEC_PER_SEC)
+#define HIGHLIGHT_TAG_BUDGET_US         4000
+#define HIGHLIGHT_TAG_CHUNK_BYTES       (16 * 1024)
+#define HIGHLIGHT_READ_CHUNK_BYTES      4096
+#define HIGHLIGHT_DELAY_MIN_MS          30
+#define HIGHLIGHT_DELAY_MAX_MS          1000
+#define PARSER_POOL_MAX_IDLE            4
+#define SPAN_CACHE_MAGIC                "GPADHL01"
+#define SPAN_CACHE_PAINT_LINES          500
+#define GRAMMAR_DIR                     "grammars"
+
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+} ByteRange;
+
+typedef enum {
+    HL_NONE = 0,
+    HL_COMMENT,
+    HL_STRING,
+    HL_PREPROC,
+    HL_KEYWORD,
+    HL_CONTROL,
+    HL_TYPE,
+    HL_NUMBER,
+    HL_FUNCTION,
+    HL_CONSTANT,
+    HL_DECORATOR,
+    HL_TAG_COUNT
+} HighlightTag;
+
+static const char *highlight_tag_names[HL_TAG_COUNT] = {
+    [HL_COMMENT]   = "comment",
+    [HL_STRING]    = "string",
+    [HL_PREPROC]   = "preproc",
+    [HL_KEYWORD]   = "keyword",
+    [HL_CONTROL]   = "control",
+    [HL_TYPE]      = "type",
+    [HL_NUMBER]    = "number",
+    [HL_FUNCTION]  = "function",
+    [HL_CONSTANT]  = "constant",
+    [HL_DECORATOR] = "decorator",
+};
+
+ 
+typedef struct {
+    const char   *node_type;
+    HighlightTag  tag;
+    gboolean      substring;
+} HighlightRule;
+
+static const HighlightRule c_rules[] = {
+    { "comment",                 HL_COMMENT,   FALSE },
+    { "string_literal",          HL_STRING,    FALSE },
+    { "char_literal",            HL_STRING,    FALSE },
+    { "preproc",                 HL_PREPROC,   TRUE  },
+    { "return",                  HL_CONTROL,   FALSE },
+    { "if",                      HL_CONTROL,   FALSE },
+    { "for",                     HL_CONTROL,   FALSE },
+    { "while",                   HL_CONTROL,   FALSE },
+    { "break",                   HL_CONTROL,   FALSE },
+    { "case",                    HL_CONTROL,   FALSE },
+    { "storage_class_specifier", HL_KEYWORD,   FALSE },
+    { "type_qualifier",          HL_KEYWORD,   FALSE },
+    { "struct",                  HL_KEYWORD,   FALSE },
+    { "typedef",                 HL_KEYWORD,   FALSE },
+    { "primitive_type",          HL_TYPE,      FALSE },
+    { "type_identifier",         HL_TYPE,      FALSE },
+    { "number_literal",          HL_NUMBER,    FALSE },
+    { NULL,                      HL_NONE,      FALSE },
+};
+
+static const HighlightRule python_rules[] = {
+    { "comment",                 HL_COMMENT,   FALSE },
+    { "string",                  HL_STRING,    FALSE },
+    { "from",                    HL_PREPROC,   FALSE },
+    { "import",                  HL_PREPROC,   FALSE },
+    { "as",                      HL_PREPROC,   FALSE },
+    { "if",                      HL_CONTROL,   FALSE },
+    { "for",                     HL_CONTROL,   FALSE },
+    { "while",                   HL_CONTROL,   FALSE },
+    { "return",                  HL_CONTROL,   FALSE },
+    { "in",                      HL_CONTROL,   FALSE },
+    { "try",                     HL_CONTROL,   FALSE },
+    { "except",                  HL_CONTROL,   FALSE },
+    { "def",                     HL_KEYWORD,   FALSE },
+    { "class",                   HL_KEYWORD,   FALSE },
+    { "pass",                    HL_KEYWORD,   FALSE },
+    { "type",                    HL_TYPE,      FALSE },
+    { "integer",                 HL_NUMBER,    FALSE },
+    { "float",                   HL_NUMBER,    FALSE },
+    { "decorator",               HL_DECORATOR, FALSE },
+    { NULL,                      HL_NONE,      FALSE },
+};
+
+static const HighlightRule dart_rules[] = {
+    { "comment",                 HL_COMMENT,   FALSE },
+    { "string_literal",          HL_STRING,    FALSE },
+    { "import_directive",        HL_PREPROC,   FALSE },
+    { "export_directive",        HL_PREPROC,   FALSE },
+    { "if_statement",            HL_CONTROL,   FALSE },
+    { "for_statement",           HL_CONTROL,   FALSE },
+    { "while_statement",         HL_CONTROL,   FALSE },
+    { "return_statement",        HL_CONTROL,   FALSE },
+    { "class_definition",        HL_KEYWORD,   FALSE },
+    { "final",                   HL_KEYWORD,   FALSE },
+    { "const",                   HL_KEYWORD,   FALSE },
+    { "static",                  HL_KEYWORD,   FALSE },
+    { "type_name",               HL_TYPE,      FALSE },
+    { "primitive_type",          HL_TYPE,      FALSE },
+    { "number_literal",          HL_NUMBER,    FALSE },
+    { "annotation",              HL_DECORATOR, FALSE },
+    { NULL,                      HL_NONE,      FALSE },
+};
+
+ 
+static const char *const c_fold_types[] = {
+    "function_definition", "struct_specifier", "union_specifier", "enum_specifier", "comment", NULL,
+};
+
+static const char *const python_fold_types[] = {
+    "function_definition", "class_definition", "string", NULL,
+};
+
+static const char *const dart_fold_types[] = {
+    "class_definition", "function_body", "comment", "documentation_comment", NULL,
+};
+
+ 
+typedef struct {
+    LanguageType         lang;
+    const char          *name;
+    const HighlightRule *rules;
+    const char *const   *fold_types;
+    gboolean             load_attempted;
+    const TSLanguage    *language;
+    guint8              *symbol_tags;
+    guint8              *symbol_folds;
+    uint32_t             symbol_count;
+    TSQuery             *query;
+    guint8              *capture_tags;
+    char                *query_source;
+    uint32_t             query_length;
+} LanguageHighlighter;
+
+static LanguageHighlighter highlighters[] = {
+    { LANG_C,      "c",      c_rules,      c_fold_types,      FALSE, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0 },
+    { LANG_PYTHON, "python", python_rules, python_fold_types, FALSE, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0 },
+    { LANG_DART,   "dart",   dart_rules,   dart_fold_types,   FALSE, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0 },
+};
+
+static TSQueryCursor *highlight_cursor = NULL;
+
+ 
+static GMutex     parser_pool_lock;
+static GPtrArray *parser_pool[LANG_UNKNOWN];
+
+ 
+struct _ParseJob {
+    TabInfo          *tab;
+    LanguageType      lang;
+    const TSLanguage *language;
+    guint             revision;
+    size_t            abort_flag;
+    gboolean          timed_out;
+    char             *text;
+    uint32_t          length;
+    TSParser         *parser;
+    char             *chunk;
+    gint64            started;
+    gint64            elapsed;
+    guint             slice_id;
+    TSTree           *new_tree;
+    TSRange          *changed;
+    uint32_t          changed_count;
+    const LanguageHighlighter *fold_highlighter;
+    GArray           *folds;
+};
+
+ 
+typedef struct {
+    TabInfo                   *tab;
+    const LanguageHighlighter *highlighter;
+    GtkTextTag                *tags[HL_TAG_COUNT];
+    uint32_t                   start;
+    uint32_t                   end;
+} TagPass;
+
+ 
+typedef struct {
+    TabInfo  *tab;
+    TSTree   *tree;
+    uint32_t  byte;
+    gboolean  found;
+    uint32_t  open_start;
+    uint32_t  close_start;
+} BracketCache;
+
+static BracketCache bracket_cache = { NULL, NULL, 0, FALSE, 0, 0 };
+
+ 
+typedef struct {
+    TabInfo  *tab;
+    TSTree   *tree;
+    uint32_t  byte;
+    gboolean  found;
+    TSNode    node;
+} ScopeCache;
+
+static ScopeCache scope_cache;
+
+static const char *const bracket_pairs[][2] = {
+    { "(", ")" },
+    { "[", "]" },
+    { "{", "}" },
+};
+
+
+ 
+/**
+ * Builds the symbol-to-tag table of a language from its rule list, so the AST
+ * walk resolves a node's tag with a single array load. The first matching rule wins.
+ * Also marks the symbols whose nodes can be folded.
+ */
+static void build_symbol_table(LanguageHighlighter *highlighter) {
+    const TSLanguage *ts_lang = highlighter->language;
+
+    highlighter->symbol_count = ts_language_symbol_count(ts_lang);
+    highlighter->symbol_tags = g_new0(guint8, highlighter->symbol_count);
+    highlighter->symbol_folds = g_new0(guint8, highlighter->symbol_count);
+
+    for (uint32_t sym = 0; sym < highlighter->symbol_count; sym++) {
+        const char *name = ts_language_symbol_name(ts_lang, (TSSymbol)sym);
+        if (!name) continue;
+        for (const char *const *type = highlighter->fold_types; *type; type++)
+            if (strcmp(name, *type) == 0) highlighter->symbol_folds[sym] = TRUE;
+        for (const HighlightRule *rule = highlighter->rules; rule->node_type; rule++) {
+            gboolean match = rule->substring ? strstr(name, rule->node_type) != NULL
+                                             : strcmp(name, rule->node_type) == 0;
+            if (match) {
+                highlighter->symbol_tags[sym] = (guint8)rule->tag;
+                break;
+            }
+        }
+    }
+}
+
+ 
+/**
+ * Maps a query capture name to a tag. A dotted name such as "function.macro"
+ * falls back to its shorter prefixes until one names a tag.
+ */
+static HighlightTag tag_for_capture(const char *name, uint32_t length) {
+    char *key = g_strndup(name, length);
+    HighlightTag tag = HL_NONE;
+
+    for (;;) {
+        for (int t = HL_NONE + 1; t < HL_TAG_COUNT && tag == HL_NONE; t++)
+            if (strcmp(key, highlight_tag_names[t]) == 0) tag = (HighlightTag)t;
+
+        char *dot = strrchr(key, '.');
+        if (tag != HL_NONE || !dot) break;
+        *dot = '\0';
+    }
+
+    g_free(key);
+    return tag;
+}
+
+ 
+/**
+ * Returns a table mapping each capture id of a query to its tag.
+ */
+static guint8* map_capture_tags(const TSQuery *query) {
+    uint32_t capture_count = ts_query_capture_count(query);
+    guint8 *capture_tags = g_new0(guint8, MAX(capture_count, 1));
+    for (uint32_t i = 0; i < capture_count; i++) {
+        uint32_t name_length = 0;
+        const char *name = ts_query_capture_name_for_id(query, i, &name_length);
+        capture_tags[i] = (guint8)tag_for_capture(name, name_length);
+    }
+    return capture_tags;
+}
+
+ 
+/**
+ * Loads and compiles queries/<name>/highlights.scm for a language once and maps
+ * its captures to tags. On any error the language keeps using its symbol table.
+ */
+static void load_highlight_query(LanguageHighlighter *highlighter) {
+    const TSLanguage *ts_lang = highlighter->language;
+
+    char *path = g_build_filename("queries", highlighter->name, "highlights.scm", NULL);
+    char *source = NULL;
+    gsize length = 0;
+    GError *error = NULL;
+
+    if (!g_file_get_contents(path, &source, &length, &error)) {
+        g_warning("No highlight query for %s: %s", highlighter->name, error->message);
+        g_error_free(error);
+        g_free(path);
+        return;
+    }
+
+    uint32_t error_offset = 0;
+    TSQueryError error_type = TSQueryErrorNone;
+    TSQuery *query = ts_query_new(ts_lang, source, (uint32_t)length, &error_offset, &error_type);
+    if (!query) {
+        g_warning("Failed to compile %s (error %d at byte %u); using built-in highlighting.",
+                  path, (int)error_type, error_offset);
+        g_free(source);
+        g_free(path);
+        return;
+    }
+
+    highlighter->capture_tags = map_capture_tags(query);
+    highlighter->query = query;
+    highlighter->query_source = source;
+    highlighter->query_length = (uint32_t)length;
+
+    g_free(path);
+}
+ 
+/**
+ * Opens grammars/libtree-sitter-<name>.so (with the platform's module suffix)
+ * and returns the language exported as tree_sitter_<name>, or NULL if the
+ * grammar is not installed. The module stays resident because trees and
+ * parsers point into its static tables.
+ */
+static const TSLanguage* load_grammar(const char *name) {
+    char *library = g_strconcat("libtree-sitter-", name, "." G_MODULE_SUFFIX, NULL);
+    char *path = g_build_filename(GRAMMAR_DIR, library, NULL);
+    char *symbol = g_strconcat("tree_sitter_", name, NULL);
+    const TSLanguage *language = NULL;
+
+    GModule *module = g_module_open(path, G_MODULE_BIND_LAZY | G_MODULE_BIND_LOCAL);
+    if (!module) {
+        g_warning("Failed to load grammar %s: %s", path, g_module_error());
+    } else {
+        const TSLanguage *(*entry)(void) = NULL;
+        if (g_module_symbol(module, symbol, (gpointer*)&entry) && entry) {
+            g_module_make_resident(module);
+            language = entry();
+        } else {
+            g_warning("Grammar %s has no %s(): %s", path, symbol, g_module_error());
+            g_module_close(module);
+        }
+    }
+
+    g_free(symbol);
+    g_free(path);
+    g_free(library);
+    return language;
+}
+
+ 
+/**
+ * Returns the highlighter for a language, loading its grammar, symbol table and
+ * highlight query the first time a tab needs it. Returns NULL if there is no
+ * highlighter or its grammar cannot be loaded.
+ */
+static const LanguageHighlighter* highlighter_for(LanguageType lang) {
+    for (guint i = 0; i < G_N_ELEMENTS(highlighters); i++) {
+        LanguageHighlighter *highlighter = &highlighters[i];
+        if (highlighter->lang != lang) continue;
+
+        if (!highlighter->load_attempted) {
+            highlighter->load_attempted = TRUE;
+            if (!highlighter->language) highlighter->language = load_grammar(highlighter->name);
+            if (highlighter->language) {
+                build_symbol_table(highlighter);
+                load_highlight_query(highlighter);
+            }
+        }
+        return highlighter->language ? highlighter : NULL;
+    }
+    return NULL;
+}
+
+
+ 
+/**
+ * Converts an iterator to a tree-sitter point (row, byte column).
+ */
+static TSPoint iter_to_point(const GtkTextIter *iter) {
+    TSPoint point = { (uint32_t)gtk_text_iter_get_line(iter), (uint32_t)gtk_text_iter_get_line_index(iter) };
+    return point;
+}
+
+ 
+/**
+ * Maps a byte position in the pre-edit text to its position after the edit.
+ */
+static uint32_t shift_for_edit(uint32_t pos, const TSInputEdit *edit) {
+    if (pos >= edit->old_end_byte) return pos - edit->old_end_byte + edit->new_end_byte;
+    if (pos > edit->start_byte) return edit->new_end_byte;
+    return pos;
+}
+
+ 
+/**
+ * Marks [start, end) as tagged, merging it with overlapping or adjacent ranges.
+ */
+static void coverage_add(GArray *covered, uint32_t start, uint32_t end) {
+    if (start >= end) return;
+
+    guint first = 0;
+    while (first < covered->len && g_array_index(covered, ByteRange, first).end < start) first++;
+
+    ByteRange merged = { start, end };
+    guint last = first;
+    while (last < covered->len && g_array_index(covered, ByteRange, last).start <= end) {
+        ByteRange *r = &g_array_index(covered, ByteRange, last);
+        merged.start = MIN(merged.start, r->start);
+        merged.end   = MAX(merged.end, r->end);
+        last++;
+    }
+
+    if (last > first) g_array_remove_range(covered, first, last - first);
+    g_array_insert_val(covered, first, merged);
+}
+
+ 
+/**
+ * Marks [start, end) as needing to be tagged again.
+ */
+static void coverage_remove(GArray *covered, uint32_t start, uint32_t end) {
+    guint i = 0;
+    while (i < covered->len) {
+        ByteRange *r = &g_array_index(covered, ByteRange, i);
+        if (r->end <= start || r->start >= end) {
+            i++;
+        } else if (r->start < start && r->end > end) {
+            ByteRange tail = { end, r->end };
+            r->end = start;
+            g_array_insert_val(covered, i + 1, tail);
+            return;
+        } else if (r->start < start) {
+            r->end = start;
+            i++;
+        } else if (r->end > end) {
+            r->start = end;
+            i++;
+        } else {
+            g_array_remove_index(covered, i);
+        }
+    }
+}
+
+ 
+/**
+ * Moves the tagged ranges along with an edit, dropping ranges it swallowed.
+ */
+static void coverage_shift(GArray *covered, const TSInputEdit *edit) {
+    guint i = 0;
+    while (i < covered->len) {
+        ByteRange *r = &g_array_index(covered, ByteRange, i);
+        r->start = shift_for_edit(r->start, edit);
+        r->end   = shift_for_edit(r->end, edit);
+        if (r->start >= r->end) g_array_remove_index(covered, i);
+        else i++;
+    }
+}
+
+ 
+/**
+ * Walks the AST with a tree cursor and applies the tag mapped to each node's
+ * symbol. The walk is iterative, descends straight to the first child that
+ * reaches pass->start, skips subtrees that end before it and stops at the first
+ * node that starts after pass->end.
+ */
+static void apply_symbol_tags(TSNode root, const TagPass *pass) {
+    TSTreeCursor cursor = ts_tree_cursor_new(root);
+
+    for (;;) {
+        TSNode node = ts_tree_cursor_current_node(&cursor);
+        uint32_t start_byte = ts_node_start_byte(node);
+        uint32_t end_byte = ts_node_end_byte(node);
+        if (start_byte > pass->end) break;
+
+        if (end_byte >= pass->start) {
+            TSSymbol symbol = ts_node_symbol(node);
+            HighlightTag tag = symbol < pass->highlighter->symbol_count ? pass->highlighter->symbol_tags[symbol] : HL_NONE;
+
+            if (tag != HL_NONE && pass->tags[tag]) {
+                GtkTextIter start_iter, end_iter;
+                line_index_iter_at_byte(pass->tab->line_index, &start_iter, start_byte);
+                line_index_iter_at_byte(pass->tab->line_index, &end_iter, end_byte);
+                gtk_text_buffer_apply_tag(pass->tab->buffer, pass->tags[tag], &start_iter, &end_iter);
+            }
+
+            if (ts_tree_cursor_goto_first_child_for_byte(&cursor, pass->start) >= 0) continue;
+        }
+
+        gboolean done = FALSE;
+        while (!ts_tree_cursor_goto_next_sibling(&cursor)) {
+            if (!ts_tree_cursor_goto_parent(&cursor)) {
+                done = TRUE;
+                break;
+            }
+        }
+        if (done) break;
+    }
+
+    ts_tree_cursor_delete(&cursor);
+}
+
+ 
+/**
+ * Runs the language's highlight query over [pass->start, pass->end] and applies
+ * the tag of each capture. When several patterns capture the same node, the
+ * first one in the query file wins.
+ */
+static void apply_query_tags(TSNode root, const TagPass *pass) {
+    if (!highlight_cursor) highlight_cursor = ts_query_cursor_new();
+
+    ts_query_cursor_set_byte_range(highlight_cursor, pass->start, pass->end);
+    ts_query_cursor_exec(highlight_cursor, pass->highlighter->query, root);
+
+    TSQueryMatch match;
+    uint32_t capture_index;
+    uint32_t last_start = UINT32_MAX, last_end = UINT32_MAX;
+    while (ts_query_cursor_next_capture(highlight_cursor, &match, &capture_index)) {
+        TSNode node = match.captures[capture_index].node;
+        HighlightTag tag = pass->highlighter->capture_tags[match.captures[capture_index].index];
+        if (tag == HL_NONE || !pass->tags[tag]) continue;
+
+        uint32_t start_byte = ts_node_start_byte(node);
+        uint32_t end_byte = ts_node_end_byte(node);
+        if (start_byte == last_start && end_byte == last_end) continue;
+        last_start = start_byte;
+        last_end = end_byte;
+
+        GtkTextIter start_iter, end_iter;
+        line_index_iter_at_byte(pass->tab->line_index, &start_iter, start_byte);
+        line_index_iter_at_byte(pass->tab->line_index, &end_iter, end_byte);
+        gtk_text_buffer_apply_tag(pass->tab->buffer, pass->tags[tag], &start_iter, &end_iter);
+    }
+}
+
+ 
+/**
+ * Removes the syntax tags between two byte offsets and reapplies them from the
+ * tree. Other tags, such as search results, are left alone.
+ */
+static void retag_range(TabInfo *tab, uint32_t start_byte, uint32_t end_byte) {
+    const LanguageHighlighter *highlighter = highlighter_for(tab->lang_type);
+    if (!highlighter) return;
+
+    GtkTextIter start, end;
+    line_index_iter_at_byte(tab->line_index, &start, start_byte);
+    line_index_iter_at_byte(tab->line_index, &end, end_byte);
+
+    TagPass pass = { tab, highlighter, { NULL }, start_byte, end_byte };
+    GtkTextTagTable *table = gtk_text_buffer_get_tag_table(tab->buffer);
+    for (int t = HL_NONE + 1; t < HL_TAG_COUNT; t++) {
+        pass.tags[t] = gtk_text_tag_table_lookup(table, highlight_tag_names[t]);
+        if (pass.tags[t]) gtk_text_buffer_remove_tag(tab->buffer, pass.tags[t], &start, &end);
+    }
+
+    TSNode root = ts_tree_root_node((TSTree*)tab->ts_tree);
+    if (highlighter->query) apply_query_tags(root, &pass);
+    else apply_symbol_tags(root, &pass);
+}
+
+ 
+/**
+ * Tags the parts of [start, end) that are not tagged yet and records them as tagged.
+ */
+static void tag_uncovered(TabInfo *tab, uint32_t start, uint32_t end) {
+    GArray *covered = tab->ts_tagged;
+    uint32_t pos = start;
+
+    for (guint i = 0; i < covered->len && pos < end; i++) {
+        ByteRange r = g_array_index(covered, ByteRange, i);
+        if (r.end <= pos) continue;
+        if (r.start > pos) retag_range(tab, pos, MIN(r.start, end));
+        pos = MAX(pos, r.end);
+    }
+    if (pos < end) retag_range(tab, pos, end);
+
+    coverage_add(covered, start, end);
+}
+
+ 
+/**
+ * Returns the byte range of the visible lines plus a margin above and below.
+ */
+static void visible_byte_range(TabInfo *tab, uint32_t *start, uint32_t *end) {
+    GtkTextView *view = GTK_TEXT_VIEW(tab->text_view);
+    GdkRectangle rect;
+    gtk_text_view_get_visible_rect(view, &rect);
+
+    GtkTextIter top, bottom;
+    gtk_text_view_get_line_at_y(view, &top, rect.y, NULL);
+    gtk_text_view_get_line_at_y(view, &bottom, rect.y + rect.height, NULL);
+
+    int first_line = MAX(gtk_text_iter_get_line(&top) - HIGHLIGHT_VIEWPORT_MARGIN_LINES, 0);
+    int last_line  = gtk_text_iter_get_line(&bottom) + HIGHLIGHT_VIEWPORT_MARGIN_LINES;
+    gtk_text_buffer_get_iter_at_line(tab->buffer, &top, first_line);
+    gtk_text_buffer_get_iter_at_line(tab->buffer, &bottom, last_line + 1);
+
+    *start = line_index_byte_at_iter(tab->line_index, &top);
+    *end   = line_index_byte_at_iter(tab->line_index, &bottom);
+}
+
+ 
+/**
+ * Returns whether a buffer is large enough to be tagged around the viewport only.
+ */
+static gboolean use_viewport_tagging(TabInfo *tab) {
+    return gtk_text_buffer_get_line_count(tab->buffer) > HIGHLIGHT_VIEWPORT_MIN_LINES;
+}
+
+ 
+/**
+ * Orders folds by start byte, outer folds before the folds nested in them.
+ */
+static gint compare_folds(gconstpointer a, gconstpointer b) {
+    const FoldRange *fa = (const FoldRange*)a, *fb = (const FoldRange*)b;
+    if (fa->start != fb->start) return fa->start < fb->start ? -1 : 1;
+    if (fa->end != fb->end) return fa->end > fb->end ? -1 : 1;
+    return 0;
+}
+
+ 
+/**
+ * Appends a fold for every foldable node spanning several lines that overlaps
+ * [start, end), walking only the subtrees that reach into the range. Folds come
+ * out in tree order, which is the order of compare_folds: first the nodes
+ * enclosing start, then the nodes starting inside the range.
+ */
+static void collect_folds(TSNode root, const LanguageHighlighter *highlighter, uint32_t start, uint32_t end, GArray *out) {
+    TSTreeCursor cursor = ts_tree_cursor_new(root);
+
+    for (;;) {
+        TSNode node = ts_tree_cursor_current_node(&cursor);
+        uint32_t node_start = ts_node_start_byte(node);
+        uint32_t node_end = ts_node_end_byte(node);
+        if (node_start >= end) break;
+
+        if (node_end > start) {
+            TSSymbol symbol = ts_node_symbol(node);
+            if (symbol < highlighter->symbol_count && highlighter->symbol_folds[symbol] &&
+                ts_node_start_point(node).row < ts_node_end_point(node).row) {
+                FoldRange fold = { node_start, node_end, FALSE };
+                if (out->len == 0 || compare_folds(&fold, &g_array_index(out, FoldRange, out->len - 1)) != 0)
+                    g_array_append_val(out, fold);
+            }
+            if (ts_tree_cursor_goto_first_child_for_byte(&cursor, start) >= 0) continue;
+        }
+
+        gboolean done = FALSE;
+        while (!ts_tree_cursor_goto_next_sibling(&cursor)) {
+            if (!ts_tree_cursor_goto_parent(&cursor)) {
+                done = TRUE;
+                break;
+            }
+        }
+        if (done) break;
+    }
+
+    ts_tree_cursor_delete(&cursor);
+}
+
+ 
+/**
+ * Takes an idle parser for a language out of the pool, creating one when none
+ * is free. Parsers keep their language between uses, so concurrent jobs never
+ * share or reconfigure one.
+ */
+static TSParser* parser_pool_checkout(LanguageType lang, const TSLanguage *language) {
+    TSParser *parser = NULL;
+
+    g_mutex_lock(&parser_pool_lock);
+    GPtrArray *pool = parser_pool[lang];
+    if (pool && pool->len > 0)
+        parser = g_ptr_array_remove_index_fast(pool, pool->len - 1);
+    g_mutex_unlock(&parser_pool_lock);
+
+    if (parser && ts_parser_language(parser) == language) return parser;
+    if (parser) ts_parser_delete(parser);
+
+    parser = ts_parser_new();
+    if (parser && !ts_parser_set_language(parser, language)) {
+        g_warning("Tree-sitter language version mismatch; syntax highlighting disabled.");
+        ts_parser_delete(parser);
+        parser = NULL;
+    }
+    return parser;
+}
+
+ 
+/**
+ * Resets a parser and puts it back in its language's pool.
+ */
+static void parser_pool_return(LanguageType lang, TSParser *parser) {
+    ts_parser_reset(parser);
+    ts_parser_set_cancellation_flag(parser, NULL);
+    ts_parser_set_timeout_micros(parser, 0);
+
+    g_mutex_lock(&parser_pool_lock);
+    GPtrArray *pool = parser_pool[lang];
+    if (pool && pool->len < PARSER_POOL_MAX_IDLE) {
+        g_ptr_array_add(pool, parser);
+        parser = NULL;
+    }
+    g_mutex_unlock(&parser_pool_lock);
+
+    if (parser) ts_parser_delete(parser);
+}
+
+ 
+/**
+ * Frees a parse job and whatever results were not handed over to the tab.
+ */
+static void parse_job_free(gpointer data) {
+    ParseJob *job = (ParseJob*)data;
+    if (job->slice_id) g_source_remove(job->slice_id);
+    if (job->parser) parser_pool_return(job->lang, job->parser);
+    if (job->new_tree) ts_tree_delete(job->new_tree);
+    free(job->changed);
+    if (job->folds) g_array_free(job->folds, TRUE);
+    g_free(job->chunk);
+    g_free(job->text);
+    g_free(job);
+}
+
+ 
+/**
+ * Worker thread body: parses the snapshot of a buffer that has no tree yet with
+ * a pooled parser. The parse runs in timed slices that resume where they
+ * stopped, so an abort request or the overall time limit is noticed promptly.
+ * The folds of the new tree are collected here too, off the main thread.
+ */
+static void parse_job_run(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable) {
+    (void)source_object; (void)cancellable;
+    ParseJob *job = (ParseJob*)task_data;
+
+    TSParser *parser = parser_pool_checkout(job->lang, job->language);
+    if (parser) {
+        ts_parser_set_cancellation_flag(parser, &job->abort_flag);
+        ts_parser_set_timeout_micros(parser, HIGHLIGHT_PARSE_SLICE_US);
+
+        gint64 started = g_get_monotonic_time();
+        for (;;) {
+            job->new_tree = ts_parser_parse_string(parser, NULL, job->text, job->length);
+            if (job->new_tree || job->abort_flag) break;
+            if (g_get_monotonic_time() - started > HIGHLIGHT_PARSE_LIMIT_US) {
+                job->timed_out = TRUE;
+                break;
+            }
+        }
+        job->elapsed = g_get_monotonic_time() - started;
+    }
+    if (parser) parser_pool_return(job->lang, parser);
+
+    if (job->new_tree && job->fold_highlighter) {
+        job->folds = g_array_new(FALSE, FALSE, sizeof(FoldRange));
+        collect_folds(ts_tree_root_node(job->new_tree), job->fold_highlighter, 0, job->length, job->folds);
+    }
+
+    g_task_return_boolean(task, job->new_tree != NULL);
+}
+
+ 
+/**
+ * Finds the first untagged gap of [from, to) and returns whether there is one.
+ */
+static gboolean next_uncovered(GArray *covered, uint32_t from, uint32_t to, uint32_t *gap_start, uint32_t *gap_end) {
+    uint32_t pos = from;
+    for (guint i = 0; i < covered->len && pos < to; i++) {
+        ByteRange r = g_array_index(covered, ByteRange, i);
+        if (r.end <= pos) continue;
+        if (r.start > pos) break;
+        pos = r.end;
+    }
+    if (pos >= to) return FALSE;
+
+    uint32_t end = to;
+    for (guint i = 0; i < covered->len; i++) {
+        ByteRange r = g_array_index(covered, ByteRange, i);
+        if (r.start > pos) {
+            end = MIN(end, r.start);
+            break;
+        }
+    }
+    *gap_start = pos;
+    *gap_end   = end;
+    return TRUE;
+}
+
+ 
+/**
+ * Tags untagged chunks of [from, to) until the time budget runs out.
+ * Returns whether everything in the range is tagged.
+ */
+static gboolean tag_chunks(TabInfo *tab, uint32_t from, uint32_t to, gint64 deadline) {
+    uint32_t gap_start, gap_end;
+    while (next_uncovered(tab->ts_tagged, from, to, &gap_start, &gap_end)) {
+        if (g_get_monotonic_time() >= deadline) return FALSE;
+        gap_end = MIN(gap_end, gap_start + HIGHLIGHT_TAG_CHUNK_BYTES);
+        retag_range(tab, gap_start, gap_end);
+        coverage_add(tab->ts_tagged, gap_start, gap_end);
+    }
+    return TRUE;
+}
+
+ 
+/**
+ * Idle callback applying pending tags a few milliseconds at a time, visible
+ * lines first, so input and redraws never queue behind a large retag.
+ */
+static gboolean on_tag_idle(gpointer user_data) {
+    TabInfo *tab = (TabInfo*)user_data;
+    if (!tab->ts_tree || !tab->ts_tagged) {
+        tab->tag_idle_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    gint64 deadline = g_get_monotonic_time() + HIGHLIGHT_TAG_BUDGET_US;
+    GtkTextIter end_iter;
+    gtk_text_buffer_get_end_iter(tab->buffer, &end_iter);
+    uint32_t length = line_index_byte_at_iter(tab->line_index, &end_iter);
+    uint32_t pending_end = MIN(tab->tag_pending_end, length);
+
+    uint32_t view_start = 0, view_end = 0;
+    visible_byte_range(tab, &view_start, &view_end);
+    view_start = MAX(view_start, tab->tag_pending_start);
+    view_end   = MIN(view_end, pending_end);
+
+    if (view_start < view_end && !tag_chunks(tab, view_start, view_end, deadline))
+        return G_SOURCE_CONTINUE;
+    if (!tag_chunks(tab, tab->tag_pending_start, pending_end, deadline))
+        return G_SOURCE_CONTINUE;
+
+    tab->tag_idle_id = 0;
+    return G_SOURCE_REMOVE;
+}
+
+ 
+/**
+ * Queues [start, end) to be tagged from the idle loop and runs the first slice now.
+ */
+static void schedule_tagging(TabInfo *tab, uint32_t start, uint32_t end) {
+    if (tab->tag_idle_id) {
+        start = MIN(start, tab->tag_pending_start);
+        end   = MAX(end, tab->tag_pending_end);
+    }
+    tab->tag_pending_start = start;
+    tab->tag_pending_end   = end;
+
+    if (on_tag_idle(tab) == G_SOURCE_CONTINUE && !tab->tag_idle_id)
+        tab->tag_idle_id = g_idle_add(on_tag_idle, tab);
+}
+
+ 
+/**
+ * Swaps the tab's folds starting in [start, end) for the new ones. A new fold
+ * starting where an old folded one did stays folded; only the text of the
+ * replaced folded folds is shown and hidden again. Returns whether any text
+ * was shown.
+ */
+static gboolean replace_fold_block(TabInfo *tab, uint32_t start, uint32_t end, FoldRange *found, guint count) {
+    guint first = fold_index_at(tab->folds, start);
+    guint last = fold_index_at(tab->folds, end);
+    GArray *removed = g_array_sized_new(FALSE, FALSE, sizeof(FoldRange), last - first);
+    g_array_append_vals(removed, &g_array_index(tab->folds, FoldRange, first), last - first);
+    g_array_remove_range(tab->folds, first, last - first);
+
+    gboolean shown = FALSE;
+    guint j = 0;
+    for (guint i = 0; i < removed->len; i++) {
+        const FoldRange *old = &g_array_index(removed, FoldRange, i);
+        if (!old->folded) continue;
+        while (j < count && found[j].start < old->start) j++;
+        if (j < count && found[j].start == old->start) found[j++].folded = TRUE;
+        fold_apply(tab, old, FALSE);
+        shown = TRUE;
+    }
+
+    g_array_insert_vals(tab->folds, first, found, count);
+    for (guint i = 0; i < count; i++)
+        if (found[i].folded) fold_apply(tab, &g_array_index(tab->folds, FoldRange, first + i), TRUE);
+
+    g_array_free(removed, TRUE);
+    return shown;
+}
+
+ 
+/**
+ * Gives the folds enclosing a dirty range the ends the new tree has for them.
+ * Enclosing folds are matched by start, outer first; one the tab does not have
+ * yet is added unfolded. A folded fold is hidden again when its end moved or
+ * when text inside it was shown.
+ */
+static void update_enclosing_folds(TabInfo *tab, const FoldRange *found, guint count, gboolean shown) {
+    for (guint i = 0; i < count; i++) {
+        guint rank = 0;
+        while (rank < i && found[i - rank - 1].start == found[i].start) rank++;
+
+        guint at = fold_index_at(tab->folds, found[i].start) + rank;
+        FoldRange *old = at < tab->folds->len ? &g_array_index(tab->folds, FoldRange, at) : NULL;
+        if (!old || old->start != found[i].start) {
+            g_array_insert_val(tab->folds, at, found[i]);
+            continue;
+        }
+        if (old->end == found[i].end && !(old->folded && shown)) continue;
+
+        if (old->folded) fold_apply(tab, old, FALSE);
+        old->end = found[i].end;
+        if (old->folded) fold_apply(tab, old, TRUE);
+    }
+}
+
+ 
+/**
+ * Recomputes the tab's folds around the dirty ranges of a new parse; folds
+ * elsewhere are kept as they are. Folds starting in a range are replaced and
+ * folds enclosing it take their new ends, so the work follows the size of the
+ * change rather than the number of folds in the file.
+ */
+static void update_folds(TabInfo *tab, const LanguageHighlighter *highlighter, GArray *dirty) {
+    if (!tab->folds) return;
+
+    TSNode root = ts_tree_root_node((TSTree*)tab->ts_tree);
+    GArray *found = g_array_new(FALSE, FALSE, sizeof(FoldRange));
+
+    for (guint r = 0; r < dirty->len; r++) {
+        ByteRange range = g_array_index(dirty, ByteRange, r);
+        g_array_set_size(found, 0);
+        collect_folds(root, highlighter, range.start, range.end, found);
+
+        guint enclosing = 0;
+        while (enclosing < found->len && g_array_index(found, FoldRange, enclosing).start < range.start) enclosing++;
+
+        gboolean shown = replace_fold_block(tab, range.start, range.end,
+                                            &g_array_index(found, FoldRange, enclosing), found->len - enclosing);
+        update_enclosing_folds(tab, (const FoldRange*)found->data, enclosing, shown);
+    }
+
+    g_array_free(found, TRUE);
+    fold_refresh(tab);
+}
+
+ 
+/**
+ * Installs the folds a first parse collected on its worker thread, showing any
+ * text still hidden by the folds of an earlier tree.
+ */
+static void replace_folds(TabInfo *tab, ParseJob *job) {
+    if (!tab->folds) return;
+
+    if (tab->folds->len > 0) {
+        GtkTextIter start, end;
+        gtk_text_buffer_get_bounds(tab->buffer, &start, &end);
+        gtk_text_buffer_remove_tag_by_name(tab->buffer, "fold", &start, &end);
+    }
+    g_array_free(tab->folds, TRUE);
+    tab->folds = job->folds;
+    job->folds = NULL;
+    fold_refresh(tab);
+}
+
+ 
+/**
+ * Moves the tab's folds along with an edit, dropping folds it swallowed.
+ */
+static void fold_shift(GArray *folds, const TSInputEdit *edit) {
+    guint kept = 0;
+    for (guint i = 0; i < folds->len; i++) {
+        FoldRange fold = g_array_index(folds, FoldRange, i);
+        fold.start = shift_for_edit(fold.start, edit);
+        fold.end   = shift_for_edit(fold.end, edit);
+        if (fold.start < fold.end) g_array_index(folds, FoldRange, kept++) = fold;
+    }
+    g_array_set_size(folds, kept);
+}
+
+ 
+/**
+ * Folds the duration of a finished parse into the tab's running parse cost.
+ */
+static void record_parse_cost(TabInfo *tab, gint64 elapsed) {
+    tab->parse_cost_us = tab->parse_cost_us ? (3 * tab->parse_cost_us + elapsed) / 4 : elapsed;
+}
+
+ 
+/**
+ * Installs a finished parse on the main thread and retags what it changed.
+ */
+static void commit_parse(TabInfo *tab, ParseJob *job) {
+    TSTree *old_tree = (TSTree*)tab->ts_tree;
+    tab->ts_tree = job->new_tree;
+    job->new_tree = NULL;
+    if (bracket_cache.tab == tab) bracket_cache.tree = NULL;
+    if (scope_cache.tab == tab) scope_cache.tree = NULL;
+
+    if (!tab->ts_tagged) tab->ts_tagged = g_array_new(FALSE, FALSE, sizeof(ByteRange));
+
+    GArray *dirty = g_array_new(FALSE, FALSE, sizeof(ByteRange));
+    if (old_tree) {
+        for (uint32_t i = 0; i < job->changed_count; i++)
+            coverage_add(dirty, job->changed[i].start_byte, job->changed[i].end_byte);
+        if (tab->ts_edit_pending)
+            coverage_add(dirty, tab->ts_edit_start, MAX(tab->ts_edit_end, tab->ts_edit_start + 1));
+        for (guint i = 0; i < dirty->len; i++)
+            coverage_remove(tab->ts_tagged, g_array_index(dirty, ByteRange, i).start, g_array_index(dirty, ByteRange, i).end);
+    } else {
+        g_array_set_size(tab->ts_tagged, 0);
+        coverage_add(dirty, 0, MAX(job->length, 1));
+    }
+    tab->ts_edit_pending = FALSE;
+
+    const LanguageHighlighter *highlighter = highlighter_for(tab->lang_type);
+    if (job->folds) replace_folds(tab, job);
+    else if (highlighter) update_folds(tab, highlighter, dirty);
+    g_array_free(dirty, TRUE);
+
+    if (old_tree) ts_tree_delete(old_tree);
+
+    uint32_t tag_start = 0, tag_end = job->length;
+    if (use_viewport_tagging(tab)) visible_byte_range(tab, &tag_start, &tag_end);
+    schedule_tagging(tab, tag_start, MIN(tag_end, job->length));
+
+    highlight_match_brackets(tab);
+    scope_header_refresh(tab);
+}
+
+ 
+/**
+ * TSInput read callback: returns the buffer text from byte_index to the end of
+ * the line that reaches HIGHLIGHT_READ_CHUNK_BYTES, so a parse only ever holds
+ * a few lines of text instead of a copy of the whole buffer.
+ */
+static const char* read_buffer_chunk(void *payload, uint32_t byte_index, TSPoint position, uint32_t *bytes_read) {
+    (void)position;
+    ParseJob *job = (ParseJob*)payload;
+    LineIndex *index = job->tab->line_index;
+
+    g_free(job->chunk);
+    job->chunk = NULL;
+    if (byte_index >= job->length) {
+        *bytes_read = 0;
+        return "";
+    }
+
+    GtkTextIter start, end;
+    line_index_iter_at_byte(index, &start, byte_index);
+    end = start;
+    do {
+        if (!gtk_text_iter_forward_line(&end)) break;
+    } while (line_index_byte_at_iter(index, &end) - byte_index < HIGHLIGHT_READ_CHUNK_BYTES);
+
+    job->chunk  = gtk_text_buffer_get_slice(job->tab->buffer, &start, &end, TRUE);
+    *bytes_read = line_index_byte_at_iter(index, &end) - byte_index;
+    return job->chunk;
+}
+
+ 
+/**
+ * Idle callback running one time-budgeted slice of an incremental reparse.
+ * The parse resumes where the previous slice stopped; if the buffer changed in
+ * between, it restarts against the freshly edited tree.
+ */
+static gboolean on_parse_slice(gpointer user_data) {
+    TabInfo *tab = (TabInfo*)user_data;
+    ParseJob *job = tab->parse_job;
+
+    if (job->revision != tab->revision) {
+        ts_parser_reset(job->parser);
+        GtkTextIter end;
+        gtk_text_buffer_get_end_iter(tab->buffer, &end);
+        job->revision = tab->revision;
+        job->length   = line_index_byte_at_iter(tab->line_index, &end);
+    }
+
+    TSInput input = { .payload = job, .read = read_buffer_chunk, .encoding = TSInputEncodingUTF8 };
+    TSTree *old_tree = (TSTree*)tab->ts_tree;
+    gint64 slice_start = g_get_monotonic_time();
+    job->new_tree = ts_parser_parse(job->parser, old_tree, input);
+    job->elapsed += g_get_monotonic_time() - slice_start;
+    g_free(job->chunk);
+    job->chunk = NULL;
+
+    if (!job->new_tree) {
+        if (g_get_monotonic_time() - job->started <= HIGHLIGHT_PARSE_LIMIT_US)
+            return G_SOURCE_CONTINUE;
+        g_warning("Parsing %s took too long; syntax highlighting skipped until the next edit.",
+                  tab->filename ? tab->filename : "untitled buffer");
+    } else {
+        job->changed = ts_tree_get_changed_ranges(old_tree, job->new_tree, &job->changed_count);
+        record_parse_cost(tab, job->elapsed);
+        commit_parse(tab, job);
+    }
+
+    job->slice_id = 0;
+    tab->parse_job = NULL;
+    tab->parse_queued = FALSE;
+    parse_job_free(job);
+    return G_SOURCE_REMOVE;
+}
+
+ 
+/**
+ * Starts reparsing a tab that already has a tree on the main thread, reading
+ * the buffer through a TSInput. Unchanged subtrees are reused, so the parse is
+ * usually short; it runs in idle slices under the per-frame budget.
+ */
+static void start_incremental_parse(TabInfo *tab, LanguageType lang, const TSLanguage *ts_lang) {
+    TSParser *parser = parser_pool_checkout(lang, ts_lang);
+    if (!parser) return;
+    ts_parser_set_timeout_micros(parser, HIGHLIGHT_TAG_BUDGET_US);
+
+    GtkTextIter end;
+    gtk_text_buffer_get_end_iter(tab->buffer, &end);
+
+    ParseJob *job = g_new0(ParseJob, 1);
+    job->tab      = tab;
+    job->lang     = lang;
+    job->language = ts_lang;
+    job->revision = tab->revision;
+    job->length   = line_index_byte_at_iter(tab->line_index, &end);
+    job->parser   = parser;
+    job->started  = g_get_monotonic_time();
+
+    tab->parse_job = job;
+    if (on_parse_slice(tab) == G_SOURCE_CONTINUE)
+        job->slice_id = g_idle_add(on_parse_slice, tab);
+}
 
  
 /**
- * Traverses the tree-sitter AST and applies GtkTextTags to the buffer for highlighting.
+ * Main-thread completion of a parse job. Results for a closed tab are ignored;
+ * results for an outdated buffer revision are dropped and the parse is rerun.
+ * A parse that hit the time limit is not retried for the same revision.
  */
-static void apply_tags_recursive(TSNode node, GtkTextBuffer *buffer, const char *source_code, LanguageType lang) {
-    if (ts_node_is_null(node)) return;
+static void on_parse_job_done(GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    (void)source_object; (void)user_data;
+    GTask *task = G_TASK(result);
+    GError *error = NULL;
+    gboolean parsed = g_task_propagate_boolean(task, &error);
 
-    const char *type = ts_node_type(node);
-    const char *tag_name = NULL;
+    if (error) {
+        gboolean cancelled = g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+        g_error_free(error);
+        if (cancelled) return;
+    }
 
-     
-    if (lang == LANG_C) {
-        if (strcmp(type, "comment") == 0) tag_name = "comment";
-        else if (strcmp(type, "string_literal") == 0 || strcmp(type, "char_literal") == 0) tag_name = "string";
-        else if (strstr(type, "preproc") != NULL) tag_name = "preproc";
-        else if (strcmp(type, "return") == 0 || strcmp(type, "if") == 0 || strcmp(type, "for") == 0 ||
-                strcmp(type, "while") == 0 || strcmp(type, "break") == 0 || strcmp(type, "case") == 0) tag_name = "control";
-        else if (strcmp(type, "storage_class_specifier") == 0 || strcmp(type, "type_qualifier") == 0 ||
-                strcmp(type, "struct") == 0 || strcmp(type, "typedef") == 0) tag_name = "keyword";
-        else if (strcmp(type, "primitive_type") == 0 || strcmp(type, "type_identifier") == 0) tag_name = "type";
-        else if (strcmp(type, "number_literal") == 0) tag_name = "number";
-    } else if (lang == LANG_PYTHON) {
-        if (strcmp(type, "comment") == 0) tag_name = "comment";
-        else if (strcmp(type, "string") == 0) tag_name = "string";
-        else if (strcmp(type, "from") == 0 || strcmp(type, "import") == 0 || strcmp(type, "as") == 0) tag_name = "preproc";
-        else if (strcmp(type, "if") == 0 || strcmp(type, "for") == 0 || strcmp(type, "while") == 0 ||
-                strcmp(type, "return") == 0 || strcmp(type, "in") == 0 || strcmp(type, "try") == 0 ||
-                strcmp(type, "except") == 0) tag_name = "control";
-        else if (strcmp(type, "def") == 0 || strcmp(type, "class") == 0 || strcmp(type, "pass") == 0) tag_name = "keyword";
-        else if (strcmp(type, "type") == 0) tag_name = "type";
-        else if (strcmp(type, "integer") == 0 || strcmp(type, "float") == 0) tag_name = "number";
-        else if (strcmp(type, "decorator") == 0) tag_name = "decorator";
-    } else if (lang == LANG_DART) {
-        if (strcmp(type, "comment") == 0) tag_name = "comment";
-        else if (strcmp(type, "string_literal") == 0) tag_name = "string";
-        else if (strcmp(type, "import_directive") == 0 || strcmp(type, "export_directive") == 0) tag_name = "preproc";
-        else if (strcmp(type, "if_statement") == 0 || strcmp(type, "for_statement") == 0 ||
-                strcmp(type, "while_statement") == 0 || strcmp(type, "return_statement") == 0) tag_name = "control";
-        else if (strcmp(type, "class_definition") == 0 || strcmp(type, "final") == 0 ||
-                strcmp(type, "const") == 0 || strcmp(type, "static") == 0) tag_name = "keyword";
-        else if (strcmp(type, "type_name") == 0 || strcmp(type, "primitive_type") == 0) tag_name = "type";
-        else if (strcmp(type, "number_literal") == 0) tag_name = "number";
-        else if (strcmp(type, "annotation") == 0) tag_name = "decorator";
-    }
-
-    if (tag_name) {
-        uint32_t start_byte = ts_node_start_byte(node);
-        uint32_t end_byte = ts_node_end_byte(node);
+    ParseJob *job = (ParseJob*)g_task_get_task_data(task);
+    TabInfo *tab = job->tab;
+    g_clear_object(&tab->parse_cancellable);
+    tab->parse_job = NULL;
+
+    if (job->timed_out) {
+        g_warning("Parsing %s took too long; syntax highlighting skipped until the next edit.",
+                  tab->filename ? tab->filename : "untitled buffer");
+    }
+
+    const LanguageHighlighter *highlighter = highlighter_for(tab->lang_type);
+    gboolean current = job->revision == tab->revision &&
+                       highlighter && highlighter->language == job->language;
+
+    if (parsed && current) {
+        record_parse_cost(tab, job->elapsed);
+        commit_parse(tab, job);
+    }
+
+    if ((!current && !job->timed_out) || tab->parse_queued) {
+        tab->parse_queued = FALSE;
+        highlight_buffer_async(tab);
+    }
+}
+
+ 
+/**
+ * Reparses a tab and applies its highlighting. The first parse of a buffer
+ * snapshots the text and runs on a worker thread; a parse made stale by newer
+ * edits is aborted and rerun. Later parses reuse the previous tree and read the
+ * buffer in line chunks on the main thread, in time-budgeted slices. Tags are
+ * applied from the idle loop; large buffers are tagged around the viewport
+ * first and the rest is filled in as the view scrolls.
+ */
+void highlight_buffer_async(TabInfo *tab) {
+    if (!tab || !tab->line_index || tab->highlight_engine != HIGHLIGHT_ENGINE_TREE_SITTER) return;
+
+    const LanguageHighlighter *highlighter = highlighter_for(tab->lang_type);
+    if (!highlighter) return;
+
+    const TSLanguage *ts_lang = highlighter->language;
+
+    if (tab->parse_job) {
+        if (tab->parse_job->slice_id) return;
+        if (tab->parse_job->revision != tab->revision)
+            tab->parse_job->abort_flag = 1;
+        tab->parse_queued = TRUE;
+        return;
+    }
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(tab->buffer, &start, &end);
+    if (gtk_text_iter_equal(&start, &end)) return;
+
+    TSTree *old_tree = (TSTree*)tab->ts_tree;
+    if (old_tree && ts_tree_language(old_tree) != ts_lang) {
+        ts_tree_delete(old_tree);
+        tab->ts_tree = NULL;
+        old_tree = NULL;
+    }
+
+    if (old_tree) {
+        start_incremental_parse(tab, tab->lang_type, ts_lang);
+        return;
+    }
+
+    ParseJob *job = g_new0(ParseJob, 1);
+    job->tab      = tab;
+    job->lang     = tab->lang_type;
+    job->language = ts_lang;
+    job->revision = tab->revision;
+    job->text     = gtk_text_buffer_get_slice(tab->buffer, &start, &end, TRUE);
+    job->length   = line_index_byte_at_iter(tab->line_index, &end);
+    job->fold_highlighter = tab->folds ? highlighter : NULL;
+
+    tab->parse_job = job;
+    tab->parse_cancellable = g_cancellable_new();
+    GTask *task = g_task_new(NULL, tab->parse_cancellable, on_parse_job_done, NULL);
+    g_task_set_task_data(task, job, parse_job_free);
+    g_task_run_in_thread(task, parse_job_run);
+    g_object_unref(task);
+}
+
+ 
+/**
+ * Tags lines scrolled into view that have not been tagged against the current tree.
+ */
+static void on_viewport_changed(GtkAdjustment *adjustment, gpointer user_data) {
+    (void)adjustment;
+    TabInfo *tab = (TabInfo*)user_data;
+    if (!tab || !tab->ts_tree || !tab->ts_tagged || !use_viewport_tagging(tab)) return;
+
+    uint32_t start = 0, end = 0;
+    visible_byte_range(tab, &start, &end);
+    tag_uncovered(tab, start, end);
+}
+
+ 
+/**
+ * Returns how long to wait after an edit before reparsing a tab: a short pause
+ * for buffers that parse quickly, backing off as their measured parse cost grows.
+ */
+guint highlight_delay_ms(TabInfo *tab) {
+    guint cost_ms = (guint)MIN(tab->parse_cost_us / 1000, (gint64)HIGHLIGHT_DELAY_MAX_MS);
+    return CLAMP(HIGHLIGHT_DELAY_MIN_MS + 2 * cost_ms, HIGHLIGHT_DELAY_MIN_MS, HIGHLIGHT_DELAY_MAX_MS);
+}
+
+ 
+typedef struct {
+    char     magic[8];
+    gint64   mtime;
+    char     checksum[48];
+    guint32  count;
+} SpanCacheHeader;
+
+typedef struct {
+    char             *cache_path;
+    char             *text;
+    gsize             length;
+    gint64            mtime;
+    TSTree           *tree;
+    const TSLanguage *language;
+    char             *query_source;
+    uint32_t          query_length;
+} SpanCacheWrite;
+
+ 
+/**
+ * Returns the span cache file for a source file path, or NULL when the path
+ * cannot be resolved. The name is a hash of the absolute path.
+ */
+static char* span_cache_path(const char *filename) {
+    char *absolute = g_canonicalize_filename(filename, NULL);
+    char *key = g_compute_checksum_for_string(G_CHECKSUM_SHA1, absolute, -1);
+    char *name = g_strconcat(key, ".spans", NULL);
+    char *path = g_build_filename(g_get_user_cache_dir(), "gpad", name, NULL);
+    g_free(name);
+    g_free(key);
+    g_free(absolute);
+    return path;
+}
+
+ 
+/**
+ * Returns a file's modification time in seconds, or -1 if it cannot be read.
+ */
+static gint64 file_mtime(const char *filename) {
+    GStatBuf st;
+    if (g_stat(filename, &st) != 0) return -1;
+    return (gint64)st.st_mtime;
+}
+
+ 
+/**
+ * Frees a span cache write job.
+ */
+static void span_cache_write_free(gpointer data) {
+    SpanCacheWrite *job = (SpanCacheWrite*)data;
+    ts_tree_delete(job->tree);
+    g_free(job->query_source);
+    g_free(job->text);
+    g_free(job->cache_path);
+    g_free(job);
+}
+
+ 
+/**
+ * Worker thread body: runs the highlight query over the whole tree and writes
+ * the resulting (start, end) pairs followed by their tag ids to the cache file.
+ * The job compiles its own copy of the query source so it shares no state with
+ * the main thread and may outlive the highlighters.
+ */
+static void span_cache_write_run(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable) {
+    (void)source_object; (void)cancellable;
+    SpanCacheWrite *job = (SpanCacheWrite*)task_data;
+
+    uint32_t error_offset = 0;
+    TSQueryError error_type = TSQueryErrorNone;
+    TSQuery *query = ts_query_new(job->language, job->query_source, job->query_length, &error_offset, &error_type);
+    if (!query) {
+        g_task_return_boolean(task, FALSE);
+        return;
+    }
+    guint8 *capture_tags = map_capture_tags(query);
+
+    GArray *ranges = g_array_new(FALSE, FALSE, sizeof(ByteRange));
+    GByteArray *tags = g_byte_array_new();
+    TSQueryCursor *cursor = ts_query_cursor_new();
+    ts_query_cursor_exec(cursor, query, ts_tree_root_node(job->tree));
+
+    TSQueryMatch match;
+    uint32_t capture_index;
+    ByteRange last = { UINT32_MAX, UINT32_MAX };
+    while (ts_query_cursor_next_capture(cursor, &match, &capture_index)) {
+        TSNode node = match.captures[capture_index].node;
+        guint8 tag = capture_tags[match.captures[capture_index].index];
+        ByteRange range = { ts_node_start_byte(node), ts_node_end_byte(node) };
+        if (tag == HL_NONE || (range.start == last.start && range.end == last.end)) continue;
+        last = range;
+        g_array_append_val(ranges, range);
+        g_byte_array_append(tags, &tag, 1);
+    }
+
+    SpanCacheHeader header = { { 0 }, job->mtime, { 0 }, ranges->len };
+    memcpy(header.magic, SPAN_CACHE_MAGIC, sizeof(header.magic));
+    char *checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA1, (const guchar*)job->text, job->length);
+    g_strlcpy(header.checksum, checksum, sizeof(header.checksum));
+    g_free(checksum);
+
+    GByteArray *out = g_byte_array_new();
+    g_byte_array_append(out, (const guint8*)&header, sizeof(header));
+    g_byte_array_append(out, (const guint8*)ranges->data, ranges->len * sizeof(ByteRange));
+    g_byte_array_append(out, tags->data, tags->len);
+
+    char *dir = g_path_get_dirname(job->cache_path);
+    g_mkdir_with_parents(dir, 0700);
+    gboolean written = g_file_set_contents(job->cache_path, (const char*)out->data, out->len, NULL);
+    g_free(dir);
+
+    g_byte_array_free(out, TRUE);
+    g_byte_array_free(tags, TRUE);
+    g_array_free(ranges, TRUE);
+    ts_query_cursor_delete(cursor);
+    g_free(capture_tags);
+    ts_query_delete(query);
+
+    g_task_return_boolean(task, written);
+}
+
+ 
+/**
+ * Saves the highlight spans of a tab whose buffer matches the file on disk to
+ * the span cache, so reopening the file can paint colours before it is parsed.
+ * The write runs in the background unless wait is set. Buffers with unsaved or
+ * discarded edits are skipped, since their spans would be recorded under the
+ * file's modification time.
+ */
+static void save_span_cache(TabInfo *tab, gboolean wait) {
+    if (!tab->filename || !tab->ts_tree || gtk_text_buffer_get_modified(tab->buffer)) return;
+
+    const LanguageHighlighter *highlighter = highlighter_for(tab->lang_type);
+    if (!highlighter || !highlighter->query_source) return;
+
+    gint64 mtime = file_mtime(tab->filename);
+    if (mtime < 0) return;
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(tab->buffer, &start, &end);
+
+    SpanCacheWrite *job = g_new0(SpanCacheWrite, 1);
+    job->cache_path   = span_cache_path(tab->filename);
+    job->text         = gtk_text_buffer_get_slice(tab->buffer, &start, &end, TRUE);
+    job->length       = strlen(job->text);
+    job->mtime        = mtime;
+    job->tree         = ts_tree_copy((TSTree*)tab->ts_tree);
+    job->language     = highlighter->language;
+    job->query_source = g_strndup(highlighter->query_source, highlighter->query_length);
+    job->query_length = highlighter->query_length;
+
+    GTask *task = g_task_new(NULL, NULL, NULL, NULL);
+    g_task_set_task_data(task, job, span_cache_write_free);
+    if (wait) g_task_run_in_thread_sync(task, span_cache_write_run);
+    else g_task_run_in_thread(task, span_cache_write_run);
+    g_object_unref(task);
+}
+
+ 
+/**
+ * Writes the span cache of an open tab and waits for it, for tabs still open
+ * when the application quits.
+ */
+void highlight_save_spans(TabInfo *tab) {
+    if (!tab || !tab->buffer || tab->highlight_engine != HIGHLIGHT_ENGINE_TREE_SITTER) return;
+    save_span_cache(tab, TRUE);
+}
+
+ 
+/**
+ * Paints cached highlight spans onto a freshly loaded tab when the cache entry
+ * matches the file's modification time and content hash. Only the first lines
+ * are painted; the real parse retags everything once it lands.
+ */
+void highlight_restore_spans(TabInfo *tab, const char *contents, gsize length) {
+    if (!tab || !tab->filename || !contents || tab->highlight_engine != HIGHLIGHT_ENGINE_TREE_SITTER) return;
+
+    char *cache_path = span_cache_path(tab->filename);
+    char *data = NULL;
+    gsize size = 0;
+    gboolean loaded = g_file_get_contents(cache_path, &data, &size, NULL);
+    g_free(cache_path);
+    if (!loaded) return;
+
+    SpanCacheHeader header;
+    if (size < sizeof(header)) {
+        g_free(data);
+        return;
+    }
+    memcpy(&header, data, sizeof(header));
+    header.checksum[sizeof(header.checksum) - 1] = '\0';
+
+    gboolean valid = memcmp(header.magic, SPAN_CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+                     header.mtime == file_mtime(tab->filename) &&
+                     size == sizeof(header) + (gsize)header.count * (sizeof(ByteRange) + 1);
+    if (valid) {
+        char *checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA1, (const guchar*)contents, length);
+        valid = strcmp(checksum, header.checksum) == 0;
+        g_free(checksum);
+    }
+    if (!valid) {
+        g_free(data);
+        return;
+    }
 
+    const ByteRange *ranges = (const ByteRange*)(data + sizeof(header));
+    const guint8 *tags = (const guint8*)(ranges + header.count);
+
+    GtkTextIter limit_iter;
+    gtk_text_buffer_get_iter_at_line(tab->buffer, &limit_iter, SPAN_CACHE_PAINT_LINES);
+    if (gtk_text_iter_get_line(&limit_iter) < SPAN_CACHE_PAINT_LINES) gtk_text_iter_forward_to_end(&limit_iter);
+    uint32_t limit = line_index_byte_at_iter(tab->line_index, &limit_iter);
+
+    GtkTextTagTable *table = gtk_text_buffer_get_tag_table(tab->buffer);
+    GtkTextTag *tag_objects[HL_TAG_COUNT] = { NULL };
+    for (int t = HL_NONE + 1; t < HL_TAG_COUNT; t++)
+        tag_objects[t] = gtk_text_tag_table_lookup(table, highlight_tag_names[t]);
+
+    for (guint32 i = 0; i < header.count && ranges[i].start < limit; i++) {
+        if (tags[i] >= HL_TAG_COUNT || !tag_objects[tags[i]] || ranges[i].end > length) continue;
         GtkTextIter start_iter, end_iter;
-        gtk_text_buffer_get_iter_at_offset(buffer, &start_iter, start_byte);
-        gtk_text_buffer_get_iter_at_offset(buffer, &end_iter, end_byte);
+        line_index_iter_at_byte(tab->line_index, &start_iter, ranges[i].start);
+        line_index_iter_at_byte(tab->line_index, &end_iter, ranges[i].end);
+        gtk_text_buffer_apply_tag(tab->buffer, tag_objects[tags[i]], &start_iter, &end_iter);
+    }
 
-        gtk_text_buffer_apply_tag_by_name(buffer, tag_name, &start_iter, &end_iter);
+    g_free(data);
+}
+
+ 
+/**
+ * Returns the index of a bracket token type in bracket_pairs and whether it
+ * opens, or -1 if the node is not a bracket.
+ */
+static int bracket_kind(TSNode node, gboolean *opening) {
+    if (ts_node_is_null(node) || ts_node_is_named(node)) return -1;
+    const char *type = ts_node_type(node);
+    for (guint i = 0; i < G_N_ELEMENTS(bracket_pairs); i++) {
+        if (strcmp(type, bracket_pairs[i][0]) == 0) { *opening = TRUE;  return (int)i; }
+        if (strcmp(type, bracket_pairs[i][1]) == 0) { *opening = FALSE; return (int)i; }
     }
+    return -1;
+}
 
-     
-    for (uint32_t i = 0; i < ts_node_child_count(node); ++i) {
-        apply_tags_recursive(ts_node_child(node, i), buffer, source_code, lang);
+ 
+/**
+ * Returns whether a node is the anonymous bracket token of the given type.
+ */
+static gboolean is_bracket_token(TSNode node, const char *type) {
+    return !ts_node_is_null(node) && !ts_node_is_named(node) && strcmp(ts_node_type(node), type) == 0;
+}
+
+ 
+/**
+ * Finds the bracket token starting at byte and its counterpart among its
+ * siblings. Brackets of one pair are children of the same node, so after one
+ * descent to the token the parent's children are walked once with a cursor:
+ * O(depth + k) for a parent with k children. ts_node_child and
+ * ts_node_next_sibling would rescan the parent from its first child.
+ */
+static gboolean find_bracket_pair(TSNode root, uint32_t byte, uint32_t *open_start, uint32_t *close_start) {
+    TSNode node = ts_node_descendant_for_byte_range(root, byte, byte + 1);
+    if (ts_node_start_byte(node) != byte) return FALSE;
+
+    gboolean opening = FALSE;
+    int kind = bracket_kind(node, &opening);
+    if (kind < 0) return FALSE;
+
+    TSNode parent = ts_node_parent(node);
+    if (ts_node_is_null(parent)) return FALSE;
+
+    const char *partner_type = bracket_pairs[kind][opening ? 1 : 0];
+    gboolean found = FALSE;
+    uint32_t partner = 0;
+
+    TSTreeCursor cursor = ts_tree_cursor_new(parent);
+    if (ts_tree_cursor_goto_first_child(&cursor)) {
+        do {
+            TSNode child = ts_tree_cursor_current_node(&cursor);
+            uint32_t start = ts_node_start_byte(child);
+            if (opening && start > byte && is_bracket_token(child, partner_type)) {
+                partner = start;
+                found = TRUE;
+                break;
+            }
+            if (!opening) {
+                if (start >= byte) break;
+                if (is_bracket_token(child, partner_type)) {
+                    partner = start;
+                    found = TRUE;
+                }
+            }
+        } while (ts_tree_cursor_goto_next_sibling(&cursor));
     }
+    ts_tree_cursor_delete(&cursor);
+    if (!found) return FALSE;
+
+    *open_start  = opening ? byte : partner;
+    *close_start = opening ? partner : byte;
+    return TRUE;
+}
+
+ 
+/**
+ * Looks up the bracket pair at the cursor: the bracket after it, else the one
+ * before it. The answer is cached until the next edit or parse.
+ */
+static gboolean bracket_pair_at_cursor(TabInfo *tab, uint32_t *open_start, uint32_t *close_start) {
+    GtkTextIter cursor;
+    gtk_text_buffer_get_iter_at_mark(tab->buffer, &cursor, gtk_text_buffer_get_insert(tab->buffer));
+    uint32_t byte = line_index_byte_at_iter(tab->line_index, &cursor);
+
+    TSTree *tree = (TSTree*)tab->ts_tree;
+    if (bracket_cache.tab != tab || bracket_cache.tree != tree || bracket_cache.byte != byte) {
+        TSNode root = ts_tree_root_node(tree);
+        bracket_cache.tab   = tab;
+        bracket_cache.tree  = tree;
+        bracket_cache.byte  = byte;
+        bracket_cache.found = find_bracket_pair(root, byte, &bracket_cache.open_start, &bracket_cache.close_start);
+        if (!bracket_cache.found && byte > 0) {
+            GtkTextIter before = cursor;
+            gtk_text_iter_backward_char(&before);
+            bracket_cache.found = find_bracket_pair(root, line_index_byte_at_iter(tab->line_index, &before),
+                                                    &bracket_cache.open_start, &bracket_cache.close_start);
+        }
+    }
+
+    *open_start  = bracket_cache.open_start;
+    *close_start = bracket_cache.close_start;
+    return bracket_cache.found;
 }
 
  
 /**
- * Synchronously parses the buffer and applies syntax highlighting.
+ * Marks the bracket pair at the cursor with the "bracket-match" tag, from the
+ * syntax tree instead of a character scan of the line.
  */
-void highlight_buffer_sync(GtkTextBuffer *buffer, TSTreePtr *ts_tree, LanguageType lang) {
-    if (lang == LANG_UNKNOWN || !ts_parser) return;
+void highlight_match_brackets(TabInfo *tab) {
+    if (!tab || !tab->ts_tree || !tab->line_index) return;
 
-    TSTree **actual_tree = (TSTree**)ts_tree;   
+    GtkTextTag *tag = gtk_text_tag_table_lookup(gtk_text_buffer_get_tag_table(tab->buffer), "bracket-match");
+    if (!tag) return;
 
     GtkTextIter start, end;
-    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    gtk_text_buffer_get_bounds(tab->buffer, &start, &end);
+    gtk_text_buffer_remove_tag(tab->buffer, tag, &start, &end);
 
-    if (gtk_text_iter_get_offset(&start) == gtk_text_iter_get_offset(&end)) return;
+    uint32_t open_start, close_start;
+    if (!bracket_pair_at_cursor(tab, &open_start, &close_start)) return;
 
-    char *text = gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+    uint32_t marks[2] = { open_start, close_start };
+    for (int i = 0; i < 2; i++) {
+        line_index_iter_at_byte(tab->line_index, &start, marks[i]);
+        end = start;
+        gtk_text_iter_forward_char(&end);
+        gtk_text_buffer_apply_tag(tab->buffer, tag, &start, &end);
+    }
+}
 
-     
-    gtk_text_buffer_remove_all_tags(buffer, &start, &end);
+ 
+/**
+ * Returns whether a foldable node is a scope (a function, class or other
+ * declaration worth naming), which comments and strings are not.
+ */
+static gboolean is_scope_node(const LanguageHighlighter *highlighter, TSNode node) {
+    TSSymbol symbol = ts_node_symbol(node);
+    if (symbol >= highlighter->symbol_count || !highlighter->symbol_folds[symbol]) return FALSE;
+    const char *type = ts_node_type(node);
+    return !g_str_has_suffix(type, "comment") && strcmp(type, "string") != 0;
+}
 
-     
-    TSLanguage *ts_lang = NULL;
-    if (lang == LANG_C) ts_lang = tree_sitter_c();
-    else if (lang == LANG_PYTHON) ts_lang = tree_sitter_python();
-    else if (lang == LANG_DART) ts_lang = tree_sitter_dart();
+ 
+/**
+ * Returns node or its nearest ancestor that is a scope starting before byte,
+ * or a null node if there is none.
+ */
+static TSNode scope_at_or_above(const LanguageHighlighter *highlighter, TSNode node, uint32_t byte) {
+    for (; !ts_node_is_null(node); node = ts_node_parent(node)) {
+        if (ts_node_start_byte(node) < byte && is_scope_node(highlighter, node)) return node;
+    }
+    return node;
+}
+
+ 
+/**
+ * Finds the innermost scope that starts before a byte offset and encloses it.
+ * The answer is cached per tab, tree and offset until the next edit or parse.
+ */
+static gboolean enclosing_scope_node(TabInfo *tab, const LanguageHighlighter *highlighter, uint32_t byte, TSNode *scope) {
+    TSTree *tree = (TSTree*)tab->ts_tree;
+    if (scope_cache.tab != tab || scope_cache.tree != tree || scope_cache.byte != byte) {
+        TSNode node = ts_node_descendant_for_byte_range(ts_tree_root_node(tree), byte, byte);
+        scope_cache.tab   = tab;
+        scope_cache.tree  = tree;
+        scope_cache.byte  = byte;
+        scope_cache.node  = scope_at_or_above(highlighter, node, byte);
+        scope_cache.found = !ts_node_is_null(scope_cache.node);
+    }
+
+    *scope = scope_cache.node;
+    return scope_cache.found;
+}
+
+ 
+/**
+ * Returns the first line of the declarations that start before a byte offset
+ * and enclose it, outermost first and joined with a separator, or NULL if there are
+ * none. Starts from the cached innermost scope, so it costs one descent into
+ * the tree plus a walk up the parents.
+ */
+gchar* highlight_scope_chain(TabInfo *tab, guint32 byte) {
+    if (!tab || !tab->ts_tree || !tab->line_index) return NULL;
+
+    const LanguageHighlighter *highlighter = highlighter_for(tab->lang_type);
+    if (!highlighter) return NULL;
 
-    if (ts_lang) {
-        ts_parser_set_language(ts_parser, ts_lang);
+    TSNode node;
+    if (!enclosing_scope_node(tab, highlighter, byte, &node)) return NULL;
 
-        if (*actual_tree) ts_tree_delete(*actual_tree);
-        *actual_tree = ts_parser_parse_string(ts_parser, NULL, text, strlen(text));
+    GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+    for (; !ts_node_is_null(node); node = scope_at_or_above(highlighter, ts_node_parent(node), byte)) {
+        GtkTextIter start, end;
+        line_index_iter_at_byte(tab->line_index, &start, ts_node_start_byte(node));
+        gtk_text_iter_set_line_offset(&start, 0);
+        end = start;
+        if (!gtk_text_iter_ends_line(&end)) gtk_text_iter_forward_to_line_end(&end);
+        g_ptr_array_add(names, g_strstrip(gtk_text_buffer_get_text(tab->buffer, &start, &end, TRUE)));
+    }
 
-        if (*actual_tree) {
-            TSNode root_node = ts_tree_root_node(*actual_tree);
-            apply_tags_recursive(root_node, buffer, text, lang);
+    gchar *chain = NULL;
+    if (names->len > 0) {
+        GString *text = g_string_new(NULL);
+        for (guint i = names->len; i > 0; i--) {
+            if (text->len > 0) g_string_append(text, " \xe2\x80\xba ");
+            g_string_append(text, g_ptr_array_index(names, i - 1));
         }
+        chain = g_string_free(text, FALSE);
     }
+    g_ptr_array_free(names, TRUE);
+    return chain;
+}
 
-    g_free(text);
+ 
+/**
+ * Returns whether a language has a tree-sitter grammar to highlight it with,
+ * loading the grammar on first use.
+ */
+gboolean highlight_supports_language(LanguageType lang) {
+    return highlighter_for(lang) != NULL;
 }
 
  
@@ -110,40 +1721,222 @@ void highlight_buffer_sync(GtkTextBuffer *buffer, TSTreePtr *ts_tree, LanguageTy
  */
 gboolean highlight_timeout_callback(gpointer user_data) {
     TabInfo *tab_info = (TabInfo*)user_data;
-    highlight_buffer_sync(tab_info->buffer, &tab_info->ts_tree, tab_info->lang_type);
+    highlight_buffer_async(tab_info);
     return G_SOURCE_REMOVE;
 }
 
  
 /**
- * Initializes the tree-sitter parser.
+ * Applies an edit to the tab's tree, tagged ranges and folds, and widens the pending
+ * retag range to cover it.
  */
-void init_tree_sitter(void) {
-    ts_parser = ts_parser_new();
-    if (!ts_parser) {
-        g_warning("Failed to create tree-sitter parser. Syntax highlighting disabled.");
+static void record_edit(TabInfo *tab, const TSInputEdit *edit) {
+    ts_tree_edit((TSTree*)tab->ts_tree, edit);
+    if (bracket_cache.tab == tab) bracket_cache.tree = NULL;
+    if (scope_cache.tab == tab) scope_cache.tree = NULL;
+    if (tab->ts_tagged) coverage_shift(tab->ts_tagged, edit);
+    if (tab->folds) fold_shift(tab->folds, edit);
+
+    if (tab->ts_edit_pending) {
+        tab->ts_edit_start = MIN(shift_for_edit(tab->ts_edit_start, edit), edit->start_byte);
+        tab->ts_edit_end   = MAX(shift_for_edit(tab->ts_edit_end, edit), edit->new_end_byte);
+    } else {
+        tab->ts_edit_start   = edit->start_byte;
+        tab->ts_edit_end     = edit->new_end_byte;
+        tab->ts_edit_pending = TRUE;
+    }
+}
+
+ 
+/**
+ * Records an insertion on the tab's syntax tree before the buffer applies it.
+ */
+static void on_buffer_insert_text(GtkTextBuffer *buffer, GtkTextIter *location, char *text, int len, gpointer user_data) {
+    TabInfo *tab = (TabInfo*)user_data;
+    (void)buffer;
+    if (!tab || !tab->ts_tree) return;
+
+    uint32_t start_byte = line_index_byte_at_iter(tab->line_index, location);
+    TSPoint start_point = iter_to_point(location);
+    TSPoint end_point = start_point;
+    for (int i = 0; i < len; i++) {
+        if (text[i] == '\n') {
+            end_point.row++;
+            end_point.column = 0;
+        } else {
+            end_point.column++;
+        }
+    }
+
+    TSInputEdit edit = {
+        .start_byte    = start_byte,
+        .old_end_byte  = start_byte,
+        .new_end_byte  = start_byte + (uint32_t)len,
+        .start_point   = start_point,
+        .old_end_point = start_point,
+        .new_end_point = end_point,
+    };
+    record_edit(tab, &edit);
+}
+
+ 
+/**
+ * Records a deletion on the tab's syntax tree before the buffer applies it.
+ */
+static void on_buffer_delete_range(GtkTextBuffer *buffer, GtkTextIter *start, GtkTextIter *end, gpointer user_data) {
+    TabInfo *tab = (TabInfo*)user_data;
+    (void)buffer;
+    if (!tab || !tab->ts_tree) return;
+
+    uint32_t start_byte = line_index_byte_at_iter(tab->line_index, start);
+    uint32_t old_end_byte = line_index_byte_at_iter(tab->line_index, end);
+
+    TSPoint start_point = iter_to_point(start);
+    TSInputEdit edit = {
+        .start_byte    = start_byte,
+        .old_end_byte  = old_end_byte,
+        .new_end_byte  = start_byte,
+        .start_point   = start_point,
+        .old_end_point = iter_to_point(end),
+        .new_end_point = start_point,
+    };
+    record_edit(tab, &edit);
+}
+
+ 
+/**
+ * Connects the insert/delete handlers that keep the tab's tree in sync with edits,
+ * so the next parse can reuse the unchanged parts of the previous tree, and the
+ * scroll handler that tags large buffers lazily.
+ */
+void highlight_attach(TabInfo *tab) {
+    if (!tab || !tab->buffer || tab->highlight_engine != HIGHLIGHT_ENGINE_TREE_SITTER) return;
+    if (!tab->insert_text_handler)
+        tab->insert_text_handler = g_signal_connect(tab->buffer, "insert-text", G_CALLBACK(on_buffer_insert_text), tab);
+    if (!tab->delete_range_handler)
+        tab->delete_range_handler = g_signal_connect(tab->buffer, "delete-range", G_CALLBACK(on_buffer_delete_range), tab);
+
+    if (!tab->viewport_handler && tab->scrolled_window) {
+        GtkAdjustment *vadj = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(tab->scrolled_window));
+        tab->viewport_handler = g_signal_connect(vadj, "value-changed", G_CALLBACK(on_viewport_changed), tab);
+        tab->viewport_resize_handler = g_signal_connect(vadj, "changed", G_CALLBACK(on_viewport_changed), tab);
+    }
+}
+
+ 
+/**
+ * Disconnects the highlighting handlers from the tab, saves its span cache,
+ * cancels its in-flight parse and frees its tag bookkeeping.
+ */
+void highlight_detach(TabInfo *tab) {
+    if (!tab || !tab->buffer) return;
+    if (tab->insert_text_handler) {
+        g_signal_handler_disconnect(tab->buffer, tab->insert_text_handler);
+        tab->insert_text_handler = 0;
+    }
+    if (tab->delete_range_handler) {
+        g_signal_handler_disconnect(tab->buffer, tab->delete_range_handler);
+        tab->delete_range_handler = 0;
+    }
+
+    if (tab->scrolled_window) {
+        GtkAdjustment *vadj = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(tab->scrolled_window));
+        if (tab->viewport_handler) {
+            g_signal_handler_disconnect(vadj, tab->viewport_handler);
+            tab->viewport_handler = 0;
+        }
+        if (tab->viewport_resize_handler) {
+            g_signal_handler_disconnect(vadj, tab->viewport_resize_handler);
+            tab->viewport_resize_handler = 0;
+        }
+    }
+
+    save_span_cache(tab, FALSE);
+    if (bracket_cache.tab == tab) bracket_cache.tab = NULL;
+    if (scope_cache.tab == tab) scope_cache.tab = NULL;
+
+    if (tab->ts_tagged) {
+        g_array_free(tab->ts_tagged, TRUE);
+        tab->ts_tagged = NULL;
+    }
+
+    if (tab->tag_idle_id) {
+        g_source_remove(tab->tag_idle_id);
+        tab->tag_idle_id = 0;
+    }
+
+    if (tab->parse_job) {
+        if (tab->parse_job->slice_id) {
+            parse_job_free(tab->parse_job);
+        } else {
+            tab->parse_job->abort_flag = 1;
+        }
+        tab->parse_job = NULL;
+    }
+    if (tab->parse_cancellable) {
+        g_cancellable_cancel(tab->parse_cancellable);
+        g_clear_object(&tab->parse_cancellable);
     }
 }
 
  
 /**
- * Destroys the tree-sitter parser and frees associated memory.
+ * Sets up the parser pools. Grammars, symbol tables and highlight queries are
+ * loaded per language when a tab first needs them.
+ */
+void init_tree_sitter(void) {
+    g_mutex_lock(&parser_pool_lock);
+    for (int lang = 0; lang < LANG_UNKNOWN; lang++)
+        parser_pool[lang] = g_ptr_array_new_with_free_func((GDestroyNotify)ts_parser_delete);
+    g_mutex_unlock(&parser_pool_lock);
+}
+
+ 
+/**
+ * Frees the per-language symbol tables, highlight queries and idle pooled
+ * parsers. Parsers still checked out by running jobs are deleted when they are
+ * returned. Loaded grammar modules stay resident.
  */
 void cleanup_tree_sitter(void) {
-    if (ts_parser) {
-        ts_parser_delete(ts_parser);
-        ts_parser = NULL;
+    g_mutex_lock(&parser_pool_lock);
+    for (int lang = 0; lang < LANG_UNKNOWN; lang++) {
+        if (parser_pool[lang]) {
+            g_ptr_array_free(parser_pool[lang], TRUE);
+            parser_pool[lang] = NULL;
+        }
+    }
+    g_mutex_unlock(&parser_pool_lock);
+
+    for (guint i = 0; i < G_N_ELEMENTS(highlighters); i++) {
+        g_free(highlighters[i].symbol_tags);
+        highlighters[i].symbol_tags = NULL;
+        g_free(highlighters[i].symbol_folds);
+        highlighters[i].symbol_folds = NULL;
+        highlighters[i].symbol_count = 0;
+
+        if (highlighters[i].query) {
+            ts_query_delete(highlighters[i].query);
+            highlighters[i].query = NULL;
+        }
+        g_free(highlighters[i].capture_tags);
+        highlighters[i].capture_tags = NULL;
+        g_free(highlighters[i].query_source);
+        highlighters[i].query_source = NULL;
+        highlighters[i].load_attempted = FALSE;
+    }
+
+    if (highlight_cursor) {
+        ts_query_cursor_delete(highlight_cursor);
+        highlight_cursor = NULL;
     }
 }
 
 #else
  
 
-void highlight_buffer_sync(GtkTextBuffer *buffer, TSTreePtr *ts_tree, LanguageType lang) {
+void highlight_buffer_async(TabInfo *tab) {
      
-    (void)buffer;
-    (void)ts_tree;
-    (void)lang;
+    (void)tab;
 }
 
 gboolean highlight_timeout_callback(gpointer user_data) {
@@ -152,6 +1945,49 @@ gboolean highlight_timeout_callback(gpointer user_data) {
     return G_SOURCE_REMOVE;
 }
 
+guint highlight_delay_ms(TabInfo *tab) {
+     
+    (void)tab;
+    return 0;
+}
+
+gboolean highlight_supports_language(LanguageType lang) {
+     
+    (void)lang;
+    return FALSE;
+}
+
+void highlight_restore_spans(TabInfo *tab, const char *contents, gsize length) {
+     
+    (void)tab; (void)contents; (void)length;
+}
+
+void highlight_match_brackets(TabInfo *tab) {
+     
+    (void)tab;
+}
+
+gchar* highlight_scope_chain(TabInfo *tab, guint32 byte) {
+     
+    (void)tab; (void)byte;
+    return NULL;
+}
+
+void highlight_attach(TabInfo *tab) {
+     
+    (void)tab;
+}
+
+void highlight_detach(TabInfo *tab) {
+     
+    (void)tab;
+}
+
+void highlight_save_spans(TabInfo *tab) {
+     
+    (void)tab;
+}
+
 void init_tree_sitter(void) {
      
 }
@@ -1,20 +1,29 @@
 #include "gpad.h"
+#include "search.h"
 #include <gtksourceview/gtksource.h>
 
 
 
 /**
- * Trampoline function to call the highlight sync from a timeout source.
+ * Trampoline function to start a highlight pass from a timeout source.
  */
 static gboolean highlight_timeout_trampoline(gpointer user_data) {
     TabInfo *tab = (TabInfo*)user_data;
     if (!tab) return G_SOURCE_REMOVE;
 
-    highlight_buffer_sync(tab->buffer, &tab->ts_tree, tab->lang_type);
     tab->highlight_source_id = 0;
+    highlight_buffer_async(tab);
     return G_SOURCE_REMOVE;
 }
 
+/**
+ * (Re)starts the debounce timer that highlights the tab once edits pause.
+ */
+static void schedule_highlight(TabInfo *tab) {
+    if (tab->highlight_source_id) g_source_remove(tab->highlight_source_id);
+    tab->highlight_source_id = g_timeout_add(highlight_delay_ms(tab), highlight_timeout_trampoline, tab);
+}
+
 /**
  * Detects changes in the text buffer to mark the tab as dirty.
  */
@@ -22,10 +31,9 @@ static void on_buffer_changed(GtkTextBuffer *buffer, gpointer user_data) {
     (void)buffer;
     TabInfo *tab = (TabInfo*)user_data;
     if (!tab) return;
+    tab->revision++;
     if (!tab->dirty) { tab->dirty = TRUE; update_tab_label(tab); }
-    if (tab->highlight_source_id) { g_source_remove(tab->highlight_source_id); tab->highlight_source_id = 0; }
-
-
+    schedule_highlight(tab);
 }
 
 
@@ -35,9 +43,12 @@ static void on_buffer_changed(GtkTextBuffer *buffer, gpointer user_data) {
 static void on_cursor_mark_set(GtkTextBuffer *buffer, GtkTextIter *iter, GtkTextMark *mark, gpointer user_data) {
     (void)iter;
     TabInfo *tab = (TabInfo*)user_data;
-    if (!tab || !tab->text_view || !tab->auto_scroll_enabled) return;
+    if (!tab || !tab->text_view) return;
     if (mark != gtk_text_buffer_get_insert(buffer)) return;
 
+    if (tab->highlight_engine == HIGHLIGHT_ENGINE_TREE_SITTER) highlight_match_brackets(tab);
+    if (!tab->auto_scroll_enabled) return;
+
     GtkTextIter cur;
     gtk_text_buffer_get_iter_at_mark(buffer, &cur, mark);
 
@@ -92,21 +103,89 @@ void update_tab_label(TabInfo *tab_info) {
     g_free(basename);
 }
 
+typedef struct {
+    const char *name;
+    const char *light_fg;
+    const char *dark_fg;
+    const char *background;
+    PangoStyle  style;
+    PangoWeight weight;
+} TagStyle;
+
+static const TagStyle tag_styles[] = {
+    { "comment",       "#8E908C", "#7C7C7C", NULL,      PANGO_STYLE_ITALIC, PANGO_WEIGHT_NORMAL },
+    { "string",        "#2AA198", "#00FFEA", NULL,      PANGO_STYLE_NORMAL, PANGO_WEIGHT_NORMAL },
+    { "preproc",       "#CB4B16", "#FF8C42", NULL,      PANGO_STYLE_NORMAL, PANGO_WEIGHT_NORMAL },
+    { "keyword",       "#859900", "#FF00FF", NULL,      PANGO_STYLE_NORMAL, PANGO_WEIGHT_BOLD   },
+    { "control",       "#B58900", "#FFFF00", NULL,      PANGO_STYLE_NORMAL, PANGO_WEIGHT_BOLD   },
+    { "type",          "#268BD2", "#4FC1FF", NULL,      PANGO_STYLE_NORMAL, PANGO_WEIGHT_NORMAL },
+    { "number",        "#D33682", "#FF6AC1", NULL,      PANGO_STYLE_NORMAL, PANGO_WEIGHT_NORMAL },
+    { "function",      "#268BD2", "#82AAFF", NULL,      PANGO_STYLE_NORMAL, PANGO_WEIGHT_BOLD   },
+    { "constant",      "#6C71C4", "#C792EA", NULL,      PANGO_STYLE_NORMAL, PANGO_WEIGHT_NORMAL },
+    { "decorator",     "#B58900", "#FFCB6B", NULL,      PANGO_STYLE_ITALIC, PANGO_WEIGHT_NORMAL },
+    { "bracket-match", "#000000", "#101010", "#B4D8FD", PANGO_STYLE_NORMAL, PANGO_WEIGHT_BOLD   },
+    { "search-result", "#000000", "#101010", "#FFFF00", PANGO_STYLE_NORMAL, PANGO_WEIGHT_NORMAL },
+};
+
+static GtkTextTagTable *shared_tag_table = NULL;
+
 /**
- * Defines syntax highlighting tags for the GtkTextBuffer.
+ * Returns the tag table shared by every tab's buffer, creating the highlight,
+ * search and fold tags on first use. Tags added later take priority, so search
+ * results, listed last, always show over syntax colours.
  */
-void setup_highlighting_tags(GtkTextBuffer *buffer) {
-
-    gtk_text_buffer_create_tag(buffer, "comment",   "foreground", "#8E908C", "style", PANGO_STYLE_ITALIC, NULL);
-    gtk_text_buffer_create_tag(buffer, "string",    "foreground", "#2AA198", NULL);
-    gtk_text_buffer_create_tag(buffer, "preproc",   "foreground", "#CB4B16", NULL);
-    gtk_text_buffer_create_tag(buffer, "keyword",   "foreground", "#859900", "weight", PANGO_WEIGHT_BOLD, NULL);
-    gtk_text_buffer_create_tag(buffer, "control",   "foreground", "#B58900", "weight", PANGO_WEIGHT_BOLD, NULL);
-    gtk_text_buffer_create_tag(buffer, "type",      "foreground", "#268BD2", NULL);
-    gtk_text_buffer_create_tag(buffer, "number",    "foreground", "#D33682", NULL);
-    gtk_text_buffer_create_tag(buffer, "function",  "foreground", "#268BD2", "weight", PANGO_WEIGHT_BOLD, NULL);
-    gtk_text_buffer_create_tag(buffer, "constant",  "foreground", "#6C71C4", NULL);
-    gtk_text_buffer_create_tag(buffer, "decorator", "foreground", "#B58900", "style", PANGO_STYLE_ITALIC, NULL);
+GtkTextTagTable* get_shared_tag_table(void) {
+    if (shared_tag_table) return shared_tag_table;
+
+    shared_tag_table = gtk_text_tag_table_new();
+    for (guint i = 0; i < G_N_ELEMENTS(tag_styles); i++) {
+        const TagStyle *ts = &tag_styles[i];
+        GtkTextTag *tag = gtk_text_tag_new(ts->name);
+        g_object_set(tag, "foreground", ts->light_fg, "style", ts->style, "weight", ts->weight, NULL);
+        if (ts->background) g_object_set(tag, "background", ts->background, NULL);
+        gtk_text_tag_table_add(shared_tag_table, tag);
+        g_object_unref(tag);
+    }
+
+    GtkTextTag *fold_tag = gtk_text_tag_new("fold");
+    g_object_set(fold_tag, "invisible", TRUE, NULL);
+    gtk_text_tag_table_add(shared_tag_table, fold_tag);
+    g_object_unref(fold_tag);
+    return shared_tag_table;
+}
+
+/**
+ * Recolours the shared highlight tags for the light or dark theme; every open
+ * buffer picks the change up at once.
+ */
+void set_highlight_tag_theme(gboolean dark) {
+    GtkTextTagTable *table = get_shared_tag_table();
+    for (guint i = 0; i < G_N_ELEMENTS(tag_styles); i++) {
+        GtkTextTag *tag = gtk_text_tag_table_lookup(table, tag_styles[i].name);
+        if (tag) g_object_set(tag, "foreground", dark ? tag_styles[i].dark_fg : tag_styles[i].light_fg, NULL);
+    }
+}
+
+/**
+ * Releases the shared tag table.
+ */
+void cleanup_shared_tag_table(void) {
+    g_clear_object(&shared_tag_table);
+}
+
+
+
+/**
+ * Picks the one highlighter a new tab uses: tree-sitter when it has a grammar
+ * for the language, otherwise GtkSourceView, each only up to its configured
+ * size limit. Larger files are not highlighted at all.
+ */
+static HighlightEngine pick_highlight_engine(LanguageType lang_type, gboolean sourceview_lang, gsize length) {
+    if (highlight_supports_language(lang_type) && length <= gpad_config.tree_sitter_max_bytes)
+        return HIGHLIGHT_ENGINE_TREE_SITTER;
+    if (sourceview_lang && length <= gpad_config.sourceview_max_bytes)
+        return HIGHLIGHT_ENGINE_SOURCEVIEW;
+    return HIGHLIGHT_ENGINE_NONE;
 }
 
 
@@ -117,6 +196,7 @@ void setup_highlighting_tags(GtkTextBuffer *buffer) {
 void on_tab_switched(GtkNotebook *notebook, GtkWidget *page, guint page_num, gpointer user_data) {
     (void)notebook; (void)page; (void)page_num; (void)user_data;
 
+    forget_search_results();
     TabInfo *tab = get_current_tab_info();
     if (tab && tab->filename) {
         char *current_file_dir = g_path_get_dirname(tab->filename);
@@ -197,13 +277,14 @@ static void create_tab_internal(const char *filename, gboolean hide_sidebar) {
 
 
     GtkWidget *scroller = gtk_scrolled_window_new();
-    GtkSourceView *sview = GTK_SOURCE_VIEW(gtk_source_view_new());
+    GtkSourceBuffer *sbuf = gtk_source_buffer_new(get_shared_tag_table());
+    GtkSourceView *sview = GTK_SOURCE_VIEW(gtk_source_view_new_with_buffer(sbuf));
+    g_object_unref(sbuf);
     gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scroller), GTK_WIDGET(sview));
     gtk_widget_set_hexpand(scroller, TRUE);
     gtk_widget_set_vexpand(scroller, TRUE);
 
-    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(sview));
-    GtkSourceBuffer *sbuf = GTK_SOURCE_BUFFER(buffer);
+    GtkTextBuffer *buffer = GTK_TEXT_BUFFER(sbuf);
 
     if (!scroller || !sview || !buffer) {
         g_error("Failed to create tab UI elements");
@@ -226,10 +307,7 @@ static void create_tab_internal(const char *filename, gboolean hide_sidebar) {
 
     GtkSourceLanguageManager *lm = gtk_source_language_manager_get_default();
     GtkSourceLanguage *lang = gtk_source_language_manager_guess_language(lm, filename, NULL);
-    if (lang) {
-        gtk_source_buffer_set_language(sbuf, lang);
-        gtk_source_buffer_set_highlight_syntax(sbuf, TRUE);
-    }
+    if (lang) gtk_source_buffer_set_language(sbuf, lang);
 
 
     GtkSourceStyleSchemeManager *sm = gtk_source_style_scheme_manager_get_default();
@@ -246,7 +324,25 @@ static void create_tab_internal(const char *filename, gboolean hide_sidebar) {
     tab->filename         = (filename && *filename) ? g_strdup(filename) : NULL;
     tab->dirty            = FALSE;
     tab->lang_type        = get_language_from_filename(filename);
+    tab->highlight_engine = HIGHLIGHT_ENGINE_NONE;
+    tab->line_index       = NULL;
     tab->ts_tree          = NULL;
+    tab->ts_edit_pending  = FALSE;
+    tab->ts_tagged        = NULL;
+    tab->revision         = 0;
+    tab->parse_cancellable = NULL;
+    tab->parse_job        = NULL;
+    tab->parse_queued     = FALSE;
+    tab->tag_idle_id      = 0;
+    tab->tag_pending_start = 0;
+    tab->tag_pending_end  = 0;
+    tab->parse_cost_us    = 0;
+    tab->folds            = NULL;
+    tab->fold_renderer    = NULL;
+    tab->scope_header     = NULL;
+    tab->scope_tick_id    = 0;
+    tab->scope_scroll_handler = 0;
+    tab->scope_top_byte   = G_MAXUINT32;
 
     tab->auto_scroll_enabled = TRUE;
     tab->auto_scroll_yalign  = 0.30;
@@ -256,25 +352,27 @@ static void create_tab_internal(const char *filename, gboolean hide_sidebar) {
     tab->buffer_changed_handler = 0;
     tab->cursor_mark_handler    = 0;
     tab->modified_close_handler = 0;
+    tab->insert_text_handler    = 0;
+    tab->delete_range_handler   = 0;
+    tab->viewport_handler       = 0;
+    tab->viewport_resize_handler = 0;
 
 
-    setup_highlighting_tags(buffer);
-
-
+    gchar *contents = NULL;
+    gsize length = 0;
     if (filename && *filename) {
-        gchar *contents = NULL;
         GError *err = NULL;
         g_print("Loading file content: %s\n", filename);
-        if (g_file_get_contents(filename, &contents, NULL, &err)) {
+        if (g_file_get_contents(filename, &contents, &length, &err)) {
             g_signal_handlers_block_by_func(buffer, G_CALLBACK(on_buffer_changed), tab);
             gtk_text_buffer_set_text(buffer, contents, -1);
+            gtk_text_buffer_set_modified(buffer, FALSE);
             g_signal_handlers_unblock_by_func(buffer, G_CALLBACK(on_buffer_changed), tab);
 
 
 
 
             add_to_recent_files(filename);
-            g_free(contents);
             g_print("Successfully loaded file: %s\n", filename);
         } else {
             g_warning("Failed to load file %s: %s", filename, err ? err->message : "Unknown error");
@@ -282,6 +380,13 @@ static void create_tab_internal(const char *filename, gboolean hide_sidebar) {
         }
     }
 
+    tab->line_index = line_index_new(buffer);
+    tab->highlight_engine = pick_highlight_engine(tab->lang_type, lang != NULL, length);
+    gtk_source_buffer_set_highlight_syntax(sbuf, tab->highlight_engine == HIGHLIGHT_ENGINE_SOURCEVIEW);
+    gtk_source_buffer_set_highlight_matching_brackets(sbuf, tab->highlight_engine != HIGHLIGHT_ENGINE_TREE_SITTER);
+    highlight_restore_spans(tab, contents, length);
+    g_free(contents);
+
 
     GtkWidget *tab_label_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 6);
     char *base = filename && *filename ? g_path_get_basename(filename) : NULL;
@@ -302,6 +407,10 @@ static void create_tab_internal(const char *filename, gboolean hide_sidebar) {
 
     tab->buffer_changed_handler = g_signal_connect(buffer, "changed",  G_CALLBACK(on_buffer_changed),  tab);
     tab->cursor_mark_handler    = g_signal_connect(buffer, "mark-set", G_CALLBACK(on_cursor_mark_set), tab);
+    highlight_attach(tab);
+    fold_attach(tab);
+    scope_header_attach(tab);
+    schedule_highlight(tab);
     g_signal_connect(close_btn, "clicked", G_CALLBACK(on_tab_close_button_clicked), NULL);
 
 
@@ -371,7 +480,6 @@ static void on_confirm_close_response(GObject *source_object, GAsyncResult *res,
         }
     } else if (choice == 2) {
         tab->dirty = FALSE;
-        gtk_text_buffer_set_modified(tab->buffer, FALSE);
         close_current_tab();
     }
 
@@ -413,6 +521,10 @@ gboolean close_current_tab(void) {
     if (tab->buffer && tab->modified_close_handler) {
         g_signal_handler_disconnect(tab->buffer, tab->modified_close_handler); tab->modified_close_handler = 0;
     }
+    highlight_detach(tab);
+    fold_detach(tab);
+    scope_header_detach(tab);
+    forget_search_results();
 
 #ifdef HAVE_TREE_SITTER
     if (tab->ts_tree) {
@@ -422,6 +534,8 @@ gboolean close_current_tab(void) {
     }
 #endif
 
+    if (tab->line_index) { line_index_free(tab->line_index); tab->line_index = NULL; }
+
 
     int page = gtk_notebook_get_current_page(global_notebook);
     gtk_notebook_remove_page(global_notebook, page);
@@ -0,0 +1,180 @@
+#include "../search_kernels.h"
+#include <string.h>
+
+#define RANDOM_ROUNDS   100000
+#define CORPUS_BYTES    (1024 * 1024)
+#define COMPARE_SLACK   65536
+
+static const SearchKernelKind kernels[] = {
+    SEARCH_KERNEL_SCALAR,
+    SEARCH_KERNEL_SSE2,
+    SEARCH_KERNEL_AVX2,
+    SEARCH_KERNEL_AUTO,
+};
+
+static const char *const kernel_names[] = { "auto", "scalar", "sse2", "avx2" };
+
+
+/**
+ * Finds every offset of a pattern by comparing at each position, the answer
+ * all kernels are checked against.
+ */
+static GArray* brute_force(const char *text, int n, const char *pattern, int m) {
+    GArray *results = g_array_new(FALSE, FALSE, sizeof(int));
+    for (int s = 0; s + m <= n; s++) {
+        if (memcmp(text + s, pattern, m) == 0) g_array_append_val(results, s);
+    }
+    return results;
+}
+
+
+/**
+ * Runs one kernel and fails the test if it does not find exactly what the
+ * brute-force search finds.
+ */
+static void check_kernel(SearchKernelKind kind, const char *text, int n, const char *pattern, int m,
+                         const GArray *expected, const char *what) {
+    GArray *found = g_array_new(FALSE, FALSE, sizeof(int));
+    search_find_all(kind, text, n, pattern, m, found);
+
+    if (found->len != expected->len ||
+        memcmp(found->data, expected->data, found->len * sizeof(int)) != 0) {
+        g_test_message("%s kernel, %s: pattern \"%.40s\" (%d bytes) in %d bytes: %u matches, expected %u",
+                       kernel_names[kind], what, pattern, m, n, found->len, expected->len);
+        g_test_fail();
+    }
+    g_array_free(found, TRUE);
+}
+
+
+/**
+ * Checks every kernel the CPU supports against brute force on one input.
+ */
+static void check_all_kernels(const char *text, int n, const char *pattern, int m, const char *what) {
+    GArray *expected = brute_force(text, n, pattern, m);
+    for (guint k = 0; k < G_N_ELEMENTS(kernels); k++) {
+        if (search_kernel_available(kernels[k]))
+            check_kernel(kernels[k], text, n, pattern, m, expected, what);
+    }
+    g_array_free(expected, TRUE);
+}
+
+
+/**
+ * Short random texts and patterns over tiny alphabets, with the pattern
+ * planted in a third of them, so matches overlap and candidates often fail
+ * late. Lengths cover the vector tails and patterns longer than the text.
+ */
+static void test_random(void) {
+    GRand *rand = g_rand_new_with_seed(2);
+    char text[320], pattern[24];
+
+    for (int round = 0; round < RANDOM_ROUNDS && !g_test_failed(); round++) {
+        int n = g_rand_int_range(rand, 0, 300);
+        int m = g_rand_int_range(rand, 1, 21);
+        int alphabet = g_rand_int_range(rand, 1, 4);
+        for (int i = 0; i < n; i++) text[i] = 'a' + g_rand_int_range(rand, 0, alphabet);
+        for (int i = 0; i < m; i++) pattern[i] = 'a' + g_rand_int_range(rand, 0, alphabet);
+        text[n] = pattern[m] = '\0';
+        if (n > m && g_rand_int_range(rand, 0, 3) == 0)
+            memcpy(text + g_rand_int_range(rand, 0, n - m + 1), pattern, m);
+
+        check_all_kernels(text, n, pattern, m, "random");
+    }
+    g_rand_free(rand);
+}
+
+
+typedef struct {
+    const char *name;
+    char        fill;
+    const char *pattern;
+    const char *insert;
+} AdversarialCase;
+
+ 
+static const AdversarialCase adversarial_cases[] = {
+    { "aaaaab in a run",                'a', "aaaaab",                                   NULL },
+    { "b then a run in a run",          'a', "baaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", NULL },
+    { "a run with b near end",          'a', "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaabaa", NULL },
+    { "a run with b in middle",         'a', "aaaaaaaaaaaaaaaaaaaabaaaaaaaaaaaaaaaaaaa", NULL },
+    { "periodic pattern in a run",      'a', "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", NULL },
+    { "padded field",                   ' ', "                               x ",        NULL },
+    { "padded field with one match",    ' ', "                               x ",        "                               x " },
+    { "abab pattern in abab text",      '\0', "abababababababababababababababac",        "abababababababababababababababab" },
+    { "single byte in a run",           'a', "a",                                        NULL },
+};
+
+
+/**
+ * Builds a 1 MiB text from a fill byte, or by repeating insert when fill is 0,
+ * with insert also planted once in the middle.
+ */
+static char* build_corpus(const AdversarialCase *c, int *length) {
+    char *text = g_malloc(CORPUS_BYTES + 1);
+    if (c->fill) {
+        memset(text, c->fill, CORPUS_BYTES);
+    } else {
+        size_t unit = strlen(c->insert);
+        for (int i = 0; i < CORPUS_BYTES; i++) text[i] = c->insert[i % unit];
+    }
+    if (c->insert) memcpy(text + CORPUS_BYTES / 2, c->insert, strlen(c->insert));
+    text[CORPUS_BYTES] = '\0';
+    *length = CORPUS_BYTES;
+    return text;
+}
+
+
+/**
+ * Returns how many text bytes a kernel may compare on n bytes. Two-Way reads
+ * each byte at most twice. A vector kernel also screens two bytes per position
+ * and may spend about n more verifying candidates before handing off.
+ */
+static guint64 compare_bound(SearchKernelKind kind, int n) {
+    return (kind == SEARCH_KERNEL_SCALAR ? 2 : 5) * (guint64)n + COMPARE_SLACK;
+}
+
+
+/**
+ * Patterns that defeat a bad-character shift or a first/last-byte screen on
+ * long runs and padded fields. Every kernel must agree with brute force and
+ * compare no more text bytes than a linear bound allows, so a regression to
+ * O(n*m) fails rather than just running slower.
+ */
+static void test_adversarial(gconstpointer data) {
+    const AdversarialCase *c = (const AdversarialCase*)data;
+    int n = 0;
+    char *text = build_corpus(c, &n);
+    int m = strlen(c->pattern);
+
+    GArray *expected = brute_force(text, n, c->pattern, m);
+    for (guint k = 0; k < G_N_ELEMENTS(kernels); k++) {
+        if (!search_kernel_available(kernels[k])) continue;
+
+        search_bytes_compared = 0;
+        check_kernel(kernels[k], text, n, c->pattern, m, expected, c->name);
+        if (search_bytes_compared > compare_bound(kernels[k], n)) {
+            g_test_message("%s: %s kernel compared %" G_GUINT64_FORMAT " bytes of %d, bound %" G_GUINT64_FORMAT,
+                           c->name, kernel_names[kernels[k]], search_bytes_compared, n, compare_bound(kernels[k], n));
+            g_test_fail();
+        }
+    }
+    g_array_free(expected, TRUE);
+    g_free(text);
+}
+
+
+/**
+ * Registers the random cross-check and one test per adversarial case.
+ */
+int main(int argc, char **argv) {
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/search/random", test_random);
+
+    for (guint i = 0; i < G_N_ELEMENTS(adversarial_cases); i++) {
+        char *path = g_strdup_printf("/search/adversarial/%u", i);
+        g_test_add_data_func(path, &adversarial_cases[i], test_adversarial);
+        g_free(path);
+    }
+    return g_test_run();
+}